@@ -10,28 +10,54 @@
  * This is a custom allocator to process allocation requests for HOSK (NUMASK reuse). It
  * services index and intermediate layer node allocation requests. We deploy one instance
  * per (thread). The inherent latency of the OS call in numa_alloc_local (it mmaps per request)
- * practically requires these. Our allocator consists of a linear allocator with three
- * main alterations:
- *    - it can reallocate buffers, if necessary
+ * practically requires these. Our allocator is a slab allocator with three main properties:
+ *    - it maps further regions, if necessary (an arena larger than NA_REGION_MAX is mapped
+ *      region by region as it fills, so arenas are not bounded by a single mapping)
  *    - allocations are made in a specific NUMA zone
  *    - requests are custom aligned for index and intermediate nodes to fit cache lines
  *
- * A basic linear allocator works as follows: upon initialization, a buffer is allocated.
- * As allocations are requested, the pointer to the first free space is moved forward and
- * the old value is returned.
+ * Regions are carved into NA_SLAB_SIZE slabs, aligned to their size so that the header of
+ * the slab holding any object is found by masking its address. Each slab serves a single
+ * (power of two) size class; freed objects go on the free list of their slab, and each
+ * size class keeps a list of the slabs which still have room. A slab whose objects have
+ * all been freed becomes available to any size class and, beyond NA_EMPTY_KEEP such slabs,
+ * its pages are handed back to the OS with MADV_DONTNEED (they are zero-filled on reuse).
+ * Half cache line objects are packed two per line and never straddle cache lines.
+ *
+ * Only the helper thread of the enclave allocates and frees (the enclave sentinel is
+ * allocated before it starts), so no synchronization is needed. Objects which concurrent
+ * readers may still reference must pass through the reclamation limbo before nfree().
+ *
+ * Buffers can optionally be backed by huge pages (explicit MAP_HUGETLB pages when the
+ * system has reserved them, transparent huge pages otherwise), faulted in eagerly at
+ * mapping time rather than on the traversal hot path, and locked in memory. Huge page
+ * and locked arenas are never decommitted.
+ *
+ * The allocator counts the requested and size class bytes of its live objects and its
+ * slabs in use, so usage() splits the mapped bytes into used, padding, dead and idle space.
  */
 
+#include <assert.h>
 #include <numa.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 #include "allocator.h"
 #include "common.h"
 
 /* Constructor */
-numa_allocator::numa_allocator(unsigned ssize)
-   :buf_size(ssize), empty(false), num_buffers(0), buf_old(NULL),
-    other_buffers(NULL), last_alloc_half(false), cache_size(CACHE_LINE_SIZE)
+numa_allocator::numa_allocator(unsigned long ssize, int options)
+   :buf_size(ssize), regions(NULL), num_regions(0), cap_regions(0), next_slab(NULL),
+    region_end(NULL), empty_committed(NULL), empty_released(NULL), num_empty_committed(0),
+    num_decommits(0), flags(options), num_hugetlb(0), req_bytes(0), obj_bytes(0), num_slabs(0)
 {
-   buf_cur = buf_start = numa_alloc_local(buf_size);
+   if(buf_size > NA_REGION_MAX) buf_size = NA_REGION_MAX;
+   buf_size = align(buf_size, (flags & NA_HUGEPAGES) ? HUGE_PAGE_SIZE : NA_SLAB_SIZE);
+   for(int i = 0; i < NA_NUM_CLASSES; ++i) {
+      partial[i] = NULL;
+   }
+   nrealloc();
 }
 
 /* Destructor */
@@ -42,87 +68,215 @@ numa_allocator::~numa_allocator() {
 
 /* nalloc() - service allocation request */
 void* numa_allocator::nalloc(unsigned ssize) {
-   // get cache-line alignment for request
-   int alignment = (ssize <= cache_size / 2)? cache_size / 2: cache_size;
-
-   /* if the last allocation was half a cache line and we want a full cache line, we move
-      the free space pointer forward a half cache line so we don't spill over cache lines */
-   if(last_alloc_half && (alignment == cache_size)) {
-      buf_cur = (char*)buf_cur + (cache_size / 2);
-      last_alloc_half = false;
+   int cls = size_class(ssize);
+   na_slab* s = partial[cls];
+   if(s == NULL) {
+      s = slab_get(cls);
    }
-   else if(!last_alloc_half && (alignment == cache_size / 2)) {
-      last_alloc_half = true;
+   // service allocation request from the free list, else from untouched space
+   void* obj;
+   if(s->free_list != NULL) {
+      obj = s->free_list;
+      s->free_list = *(void**)obj;
+   } else {
+      obj = s->bump;
+      s->bump += s->obj_size;
    }
-   // get alignment size
-   unsigned aligned_size = align(ssize, alignment);
+   s->live++;
+   req_bytes += ssize;
+   obj_bytes += s->obj_size;
 
-   // reallocate if not enough space left
-   if((char*)buf_cur + aligned_size > (char*)buf_start + buf_size) {
-      nrealloc();
+   // a full slab leaves the partial list until one of its objects is freed
+   if(s->free_list == NULL && s->bump + s->obj_size > (char*)s + NA_SLAB_SIZE) {
+      if(s->next) s->next->prev = NULL;
+      partial[cls] = s->next;
+      s->on_partial = false;
    }
-   // service allocation request
-   buf_old = buf_cur;
-   buf_cur = (char*)buf_cur + aligned_size;
-   return buf_old;
+   return obj;
 }
 
-/* nfree() - "frees" space (in practice this does nothing unless the allocation was the last request) */
+/* nfree() - returns an object to its slab */
 void numa_allocator::nfree(void *ptr, unsigned ssize) {
-   // get alignment size
-   int alignment = (ssize <= cache_size / 2)? cache_size / 2: cache_size;
-   unsigned aligned_size = align(ssize, alignment);
-
-   // only "free" if last allocation
-   if(!memcmp(ptr, buf_old, aligned_size)) {
-      buf_cur = buf_old;
-      memset(buf_cur, 0, aligned_size);
-      if(last_alloc_half && (alignment == cache_size / 2)) {
-         last_alloc_half = false;
+   na_slab* s = (na_slab*)((unsigned long)ptr & ~((unsigned long)NA_SLAB_SIZE - 1));
+   assert(s->cls == size_class(ssize) && s->live > 0);
+   *(void**)ptr = s->free_list;
+   s->free_list = ptr;
+   s->live--;
+   req_bytes -= ssize;
+   obj_bytes -= s->obj_size;
+
+   if(s->live == 0) {
+      slab_release(s);
+   } else if(!s->on_partial) {
+      s->prev = NULL;
+      s->next = partial[s->cls];
+      if(s->next) s->next->prev = s;
+      partial[s->cls] = s;
+      s->on_partial = true;
+   }
+}
+
+/* slab_get() - prepares an empty slab for size class @cls and makes it the partial head */
+na_slab* numa_allocator::slab_get(int cls) {
+   na_slab* s;
+   if(empty_committed != NULL) {
+      s = empty_committed;
+      empty_committed = s->next;
+      num_empty_committed--;
+   } else if(empty_released != NULL) {
+      s = empty_released;
+      empty_released = s->next;
+      if(flags & NA_PREFAULT) {
+         size_t page = sysconf(_SC_PAGESIZE);
+         for(size_t off = page; off < NA_SLAB_SIZE; off += page) {
+            ((volatile char*)s)[off] = 0;
+         }
       }
+   } else {
+      if(next_slab + NA_SLAB_SIZE > region_end) {
+         nrealloc();
+      }
+      s = (na_slab*)next_slab;
+      next_slab += NA_SLAB_SIZE;
+   }
+   s->cls        = cls;
+   s->obj_size   = NA_MIN_CLASS << cls;
+   s->free_list  = NULL;
+   s->bump       = (char*)s + NA_SLAB_HEADER;
+   s->live       = 0;
+   s->committed  = true;
+   s->prev       = NULL;
+   s->next       = partial[cls];
+   if(s->next) s->next->prev = s;
+   partial[cls]  = s;
+   s->on_partial = true;
+   num_slabs++;
+   return s;
+}
+
+/* slab_release() - moves a slab whose objects were all freed to the empty lists */
+void numa_allocator::slab_release(na_slab* s) {
+   if(s->on_partial) {
+      if(s->prev) s->prev->next = s->next;
+      else        partial[s->cls] = s->next;
+      if(s->next) s->next->prev = s->prev;
+      s->on_partial = false;
    }
+   num_slabs--;
+   if(num_empty_committed < NA_EMPTY_KEEP || (flags & (NA_HUGEPAGES | NA_MLOCK))) {
+      s->next = empty_committed;
+      empty_committed = s;
+      num_empty_committed++;
+      return;
+   }
+   // keep the header page, return the rest of the slab to the OS
+   size_t page = sysconf(_SC_PAGESIZE);
+   madvise((char*)s + page, NA_SLAB_SIZE - page, MADV_DONTNEED);
+   s->committed = false;
+   s->next = empty_released;
+   empty_released = s;
+   num_decommits++;
 }
 
 /* nreset() - frees all memory buffers */
 void numa_allocator::nreset(void) {
-   if(!empty) {
-      empty = true;
-      // free other_buffers, if used
-      if(other_buffers != NULL) {
-         int i = num_buffers - 1;
-         while(i >= 0) {
-            numa_free(other_buffers[i], buf_size);
-            i--;
-         }
-         free(other_buffers);
-      }
-      // free primary buffer
-      numa_free(buf_start, buf_size);
+   for(unsigned long i = 0; i < num_regions; ++i) {
+      unmap_buffer(regions[i]);
    }
+   free(regions);
+   regions = NULL;
+   num_regions = cap_regions = 0;
 }
 
-/* nrealloc() - allocates a new buffer */
+/* nrealloc() - maps a new region to carve slabs from */
 void numa_allocator::nrealloc(void) {
-   // increase size of our old_buffers to store the previously allocated memory
-   num_buffers++;
-   if(other_buffers == NULL) {
-      assert(num_buffers == 1);
-      other_buffers = (void**)malloc(num_buffers * sizeof(void*));
-      *other_buffers = buf_start;
-   } else {
-      void** new_bufs = (void**)malloc(num_buffers * sizeof(void*));
-      for(int i = 0; i < num_buffers - 1; ++i) {
-         new_bufs[i] = other_buffers[i];
+   if(num_regions == cap_regions) {
+      cap_regions = (cap_regions == 0) ? 16 : cap_regions * 2;
+      regions = (void**)realloc(regions, cap_regions * sizeof(void*));
+   }
+   next_slab = (char*)map_buffer();
+   region_end = next_slab + buf_size;
+   regions[num_regions++] = next_slab;
+}
+
+/* map_buffer() - maps a slab aligned buffer of buf_size bytes on the local NUMA node */
+void* numa_allocator::map_buffer(void) {
+   void* buf = MAP_FAILED;
+   size_t page = sysconf(_SC_PAGESIZE);
+   size_t alignment = NA_SLAB_SIZE;
+   if(flags & NA_HUGEPAGES) {
+      buf = mmap(NULL, buf_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+      if(buf != MAP_FAILED) {
+         num_hugetlb++;
+         page = HUGE_PAGE_SIZE;
+      }
+      alignment = HUGE_PAGE_SIZE;
+   }
+   if(buf == MAP_FAILED) {
+      // map an aligned region (no reserved huge pages: ask for THP instead)
+      size_t len = buf_size + alignment;
+      char* raw = (char*)mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if(raw == MAP_FAILED) {
+         perror("mmap");
+         exit(-1);
+      }
+      char* aligned = (char*)(((unsigned long)raw + alignment - 1) & ~((unsigned long)alignment - 1));
+      if(aligned != raw) munmap(raw, aligned - raw);
+      munmap(aligned + buf_size, (raw + len) - (aligned + buf_size));
+      buf = aligned;
+      if(flags & NA_HUGEPAGES) {
+         madvise(buf, buf_size, MADV_HUGEPAGE);
       }
-      new_bufs[num_buffers-1] = buf_start;
-      free(other_buffers);
-      other_buffers = new_bufs;
    }
-   // allocate new buffer & update pointers and total size
-   buf_cur = buf_start = numa_alloc_local(buf_size);
+   numa_setlocal_memory(buf, buf_size);
+   if((flags & NA_MLOCK) && mlock(buf, buf_size) != 0) {
+      perror("mlock");
+   }
+   if(flags & NA_PREFAULT) {
+      for(size_t off = 0; off < buf_size; off += page) {
+         ((volatile char*)buf)[off] = 0;
+      }
+   }
+   return buf;
+}
+
+/* unmap_buffer() - returns a buffer to the OS */
+void numa_allocator::unmap_buffer(void* buf) {
+   if(flags & NA_MLOCK) munlock(buf, buf_size);
+   munmap(buf, buf_size);
+}
+
+/* hugetlb_buffers() - number of buffers backed by explicit huge pages */
+unsigned numa_allocator::hugetlb_buffers(void) {
+   return num_hugetlb;
+}
+
+/* decommitted_slabs() - number of times an empty slab was returned to the OS */
+unsigned long numa_allocator::decommitted_slabs(void) {
+   return num_decommits;
+}
+
+/**
+ * usage() - break down the mapped bytes (exact while the owning thread is not allocating)
+ * @u - filled with the breakdown
+ */
+void numa_allocator::usage(na_usage* u) {
+   u->reserved = num_regions * buf_size;
+   u->used     = req_bytes;
+   u->padding  = obj_bytes - req_bytes;
+   u->dead     = num_slabs * NA_SLAB_SIZE - obj_bytes;
+   u->idle     = u->reserved - num_slabs * NA_SLAB_SIZE;
+}
+
+/* size_class() - gets the size class index serving requests of @size bytes */
+inline int numa_allocator::size_class(unsigned size) {
+   int cls = 0;
+   while((unsigned)(NA_MIN_CLASS << cls) < size) cls++;
+   assert(cls < NA_NUM_CLASSES);
+   return cls;
 }
 
 /* align() - gets the aligned size given requested size */
-inline unsigned numa_allocator::align(unsigned old, unsigned alignment) {
+inline unsigned long numa_allocator::align(unsigned long old, unsigned long alignment) {
    return old + ((alignment - (old % alignment))) % alignment;
 }
@@ -8,29 +8,80 @@
 
 #include <stdlib.h>
 
+// numa_allocator buffer options
+#define NA_HUGEPAGES    0x1   // back buffers with huge pages (MAP_HUGETLB, else THP madvise)
+#define NA_PREFAULT     0x2   // fault every page in when a buffer is mapped
+#define NA_MLOCK        0x4   // lock buffers in memory
+#define HUGE_PAGE_SIZE  (2 * 1024 * 1024)
+
+#define NA_SLAB_SIZE    (64 * 1024)   // slabs are aligned to their size (header found by masking)
+#define NA_SLAB_HEADER  64            // first cache line of every slab holds its header
+#define NA_MIN_CLASS    32            // smallest size class (half a cache line)
+#define NA_NUM_CLASSES  8             // size classes 32B .. 4KB, doubling
+#define NA_EMPTY_KEEP   2             // empty slabs kept committed before decommitting
+#define NA_REGION_MAX   (1UL << 30)   // largest region mapped at once (larger arenas map further regions as they fill)
+
+/* na_slab is the header of a slab, which serves objects of a single size class */
+struct na_slab {
+   na_slab*    next;          // next slab in the partial/empty list
+   na_slab*    prev;          // previous slab in the partial list
+   void*       free_list;     // freed objects (the first word links to the next)
+   char*       bump;          // first never allocated object
+   unsigned    obj_size;      // size of the objects in this slab
+   unsigned    live;          // number of allocated objects
+   short       cls;           // size class index
+   bool        on_partial;    // slab is in its class's partial list
+   bool        committed;     // false once the object pages were returned to the OS
+};
+
+/* na_usage is a breakdown of the bytes mapped by an allocator */
+struct na_usage {
+   unsigned long  reserved;   // mapped regions
+   unsigned long  used;       // bytes requested by the live objects
+   unsigned long  padding;    // live objects rounded up to their size class
+   unsigned long  dead;       // free objects, untouched space and headers of slabs in use
+   unsigned long  idle;       // empty slabs and never used space of the regions
+};
+
 class numa_allocator {
 private:
-   void*    buf_start;
-   unsigned buf_size;
-   void*    buf_cur;
-   bool     empty;
-   void*    buf_old;
-   unsigned cache_size;
+   unsigned long buf_size;    // size of each mapped region
+   void**   regions;          // mapped regions
+   unsigned long num_regions;
+   unsigned long cap_regions;
+   char*    next_slab;        // first never used slab of the newest region
+   char*    region_end;
+
+   na_slab* partial[NA_NUM_CLASSES];   // slabs with free space, per size class
+   na_slab* empty_committed;  // fully free slabs whose pages are still resident
+   na_slab* empty_released;   // fully free slabs whose pages were decommitted
+   unsigned num_empty_committed;
+   unsigned long num_decommits;
 
-   void**   other_buffers;    // for keeping track of
-   unsigned num_buffers;      // the other buffers
+   int      flags;            // NA_* buffer options
+   unsigned num_hugetlb;      // buffers backed by MAP_HUGETLB
 
-   bool     last_alloc_half;  // for half cache line alignment
+   unsigned long req_bytes;   // bytes requested by the live objects
+   unsigned long obj_bytes;   // size class bytes of the live objects
+   unsigned long num_slabs;   // slabs serving a size class
 
+   void* map_buffer(void);
+   void unmap_buffer(void* buf);
+   na_slab* slab_get(int cls);
+   void slab_release(na_slab* s);
    void nrealloc(void);
    void nreset(void);
-   inline unsigned align(unsigned old, unsigned alignment);
+   inline int size_class(unsigned size);
+   inline unsigned long align(unsigned long old, unsigned long alignment);
 
 public:
-   numa_allocator(unsigned ssize);
+   numa_allocator(unsigned long ssize, int options = 0);
    ~numa_allocator();
    void* nalloc(unsigned size);
    void nfree(void *ptr, unsigned size);
+   unsigned hugetlb_buffers(void);
+   unsigned long decommitted_slabs(void);
+   void usage(na_usage* u);
 };
 
 #endif /* ALLOCATOR_H_ */
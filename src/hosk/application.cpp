@@ -13,17 +13,28 @@
 #include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <time.h>
 #include <unistd.h>
+#include "cold.h"
 #include "common.h"
 #include "enclave.h"
+#include "learned_index.h"
+#include "node_pool.h"
+#include "reclaim.h"
+#include "set_size.h"
 #include "skiplist.h"
 
+#define HOT_WINDOWS     1000       // the hotspot is one of HOT_WINDOWS equal slices of the key range
+#define HOT_SHIFT_OPS   (1 << 18)  // operations before the hotspot moves to another slice
+
+#define SL_ELIMINATED   2          // an update cancelled out by the opposite update of its key
+
 enum sl_optype { CONTAINS, DELETE, INSERT };
 typedef enum sl_optype sl_optype_t;
 
 /* update_results() - update the results structure */
-int update_results(sl_optype_t otype, app_res* ares, int result, int key, int old_last, int alternate) {
-   int last = old_last;
+long update_results(sl_optype_t otype, app_res* ares, int result, sl_key_t key, long old_last, int alternate) {
+   long last = old_last;
    switch (otype) {
       case CONTAINS:
          ares->contains++;
@@ -60,6 +71,45 @@ inline int get_unext(app_param* d, app_res* r) {
    return result;
 }
 
+/**
+ * next_key() - draw the key of the next operation
+ * @d   - the application parameters
+ * @ops - operations executed so far (selects the current hotspot)
+ * @e   - the enclave id (each enclave has its own hotspot)
+ *
+ * With a hotspot, @d->hotspot percent of the keys are drawn from a slice of the key
+ * range which shifts every HOT_SHIFT_OPS operations.
+ */
+static inline sl_key_t next_key(app_param* d, unsigned long ops, int e) {
+   if(d->hotspot > 0 && rand_range_re(&d->seed, 100) <= d->hotspot) {
+      long width = d->range / HOT_WINDOWS;
+      if(width < 1) width = 1;
+      long window = ((ops / HOT_SHIFT_OPS) * 337 + e * 17) % HOT_WINDOWS;
+      return window * width + rand_range_re(&d->seed, width);
+   }
+   return rand_range_re(&d->seed, d->range);
+}
+
+/**
+ * mig_sample() - sample every MIG_SAMPLE_PERIOD-th operation for the helper thread,
+ *  which migrates the nodes of keys often found on a remote NUMA zone
+ * @obj  - the enclave
+ * @key  - the search key
+ * @node - the data layer node the operation ended on
+ */
+static inline void mig_sample(enclave* obj, sl_key_t key, node_t* node) {
+   mig_state* mig = obj->mig;
+   if(++mig->tick < MIG_SAMPLE_PERIOD) return;
+   mig->tick = 0;
+   if(node->key != key) return;
+   mig->sampled++;
+   if(np_node_zone((void*)node) == node_pools[obj->get_enclave_num()]->home_zone) return;
+   mig->remote++;
+   mig->samples[mig->head % MIG_RING] = key;
+   BARRIER();
+   mig->head++;
+}
+
 /**
  * sl_finish_contains() - contains skip list operation
  * @key      - the search key
@@ -96,9 +146,12 @@ static int sl_finish_delete(sl_key_t key, node_t *node, val_t node_val) {
          /* loop until we or someone else deletes */
          while (1) {
             node_val = node->val;
-            if (NULL == node_val || node == node_val) {
+            if (NULL == node_val) {
                result = 0;
                break;
+            } else if (node == node_val) {
+               /* removed or frozen for a migration: search again */
+               break;
             } else if (CAS(&node->val, node_val, NULL)) {
                result = 1;
                break;
@@ -166,6 +219,15 @@ node_t* sl_traverse_index(enclave* obj, sl_key_t key) {
    inode_t *item, *next_item;
    node_t* ret_node = NULL;
    mnode_t* mnode = NULL;
+   if(obj->learned) {
+      sl_model* model = obj->model;
+      if(NULL != model) {
+#ifdef COUNT_TRAVERSAL
+         obj->trav_idx++;
+#endif
+         return model_lookup(model, key);
+      }
+   }
    item = obj->get_sentinel();
    int this_socket = obj->get_socket_num();
 #ifdef ADDRESS_CHECKING
@@ -214,6 +276,14 @@ node_t* sl_traverse_index(enclave* obj, sl_key_t key) {
       }
       item = next_item;
    }
+   if(NULL != obj->chunks) {
+      // binary search the chunked copy of the intermediate layer
+      ret_node = mchunk_lookup(obj->chunks, mnode, key);
+#ifdef COUNT_TRAVERSAL
+      obj->trav_idx++;
+#endif
+      if(NULL != ret_node) return ret_node;
+   }
    while(mnode->next && mnode->next->key <= key) {
       mnode = mnode->next;
 #ifdef COUNT_TRAVERSAL
@@ -224,9 +294,31 @@ node_t* sl_traverse_index(enclave* obj, sl_key_t key) {
    return mnode->node;
 }
 
+/**
+ * sl_entry() - the entry point to the data layer for @key: the node of a fresh insert of
+ *  the application thread (skipping the index layer if it holds @key), or the one found
+ *  through the index layer, whichever is closer
+ * @obj - the enclave
+ * @key - the search key
+ */
+static node_t* sl_entry(enclave* obj, sl_key_t key) {
+   node_t* fresh = (NULL != obj->pending) ? obj->pt_lookup(key) : NULL;
+   if (NULL != fresh && fresh->key == key) {
+      obj->pending->hits++;
+      return fresh;
+   }
+   node_t* node = sl_traverse_index(obj, key);
+   if (NULL != fresh && fresh->key > node->key) {
+      obj->pending->hits++;
+      return fresh;
+   }
+   return node;
+}
+
 /**
  * sl_traverse_data() - traverse data layer and finish assigned operation
- * NOTE: physical removal is attempted on logically deleted nodes
+ * NOTE: physical removal is attempted on logically deleted nodes, unless it is deferred
+ *  to the helper thread (then only an insert which links before a removed node removes it)
  * @obj    - the enclave
  * @node   - the entry point element on the data layer
  * @optype - the type of operation this is
@@ -236,13 +328,15 @@ node_t* sl_traverse_index(enclave* obj, sl_key_t key) {
  */
 int sl_traverse_data(enclave* obj, node_t* node, sl_optype_t optype,
                      sl_key_t key, val_t val, node_t** pnode) {
-   node_t* next = NULL;
+   node_t *next = NULL, *succ = NULL, *entry = node;
    val_t node_val = NULL, next_val = NULL;
-   int result = 0;
+   int result = 0, attempts = 0;
    int this_socket = obj->get_socket_num();
+   if (vn_charging) vn_access(this_socket, node, &obj->vn);
    while (1) {
       while (node == (node_val = node->val)) {
          node = node->prev;
+         if (vn_charging) vn_access(this_socket, node, &obj->vn);
 #ifdef COUNT_TRAVERSAL
          obj->trav_dat++;
 #endif
@@ -251,71 +345,156 @@ int sl_traverse_data(enclave* obj, node_t* node, sl_optype_t optype,
 #endif
       }
       next = node->next;
+      if (vn_charging) vn_access(this_socket, next, &obj->vn);
 #ifdef ADDRESS_CHECKING
       zone_access_check(this_socket, next, &obj->ap_local_accesses, &obj->ap_foreign_accesses, false);
 #endif
 #ifdef COUNT_TRAVERSAL
    obj->trav_dat++;
 #endif
+      succ = next;
       if(NULL != next) {
          next_val = next->val;
          if((node_t*)next_val == next) {
+            if (!obj->deferred) {
+               node_remove(node, next);
+               continue;
+            }
+            /* leave the unlinking to the helper: step over removed nodes and markers */
+            do {
+               succ = succ->next;
+            } while (NULL != succ && succ == (node_t*)succ->val);
+         }
+      }
+      if (NULL == succ || succ->key > key) {
+         if (next != succ && INSERT == optype && key != node->key) {
+            /* a new node must not be linked before a removed one */
             node_remove(node, next);
             continue;
          }
-      }
-      if (NULL == next || next->key > key) {
-         if (CONTAINS == optype) {
+         if (key == node->key && DL_MOVING == node_val) {
+            /* the node is a migrating copy: the original holds the key until frozen */
+            node_t* orig = node->prev;
+            node_val = orig->val;
+            if (orig->key != key || orig == node_val) continue;
+            node = orig;
+         }
+         if (node->seg && (DL_MOVING == node_val || key <= ((cold_block*)node_val)->last)) {
+            /* the key is covered by a cold segment: wait until it is built, then read it
+               in place or split it to update */
+            if (DL_MOVING == node_val) continue;
+            if (CONTAINS != optype) {
+               cold_split(node, (cold_block*)node_val);
+               continue;
+            }
+            val_t cold_val;
+            result = cold_find((cold_block*)node_val, key, &cold_val) && NULL != cold_val;
+         } else if (CONTAINS == optype) {
             result = sl_finish_contains(key, node, node_val);
          } else if (DELETE == optype) {
             result = sl_finish_delete(key, node, node_val);
          } else if (INSERT == optype) {
             result = sl_finish_insert(key, val, node, node_val, next, pnode);
          }
-         if (-1 != result) break;
+         if (-1 != result) {
+            if (obj->migrate) mig_sample(obj, key, node);
+            break;
+         }
+         /* the update lost a race: back off, then resume at the predecessor (or the entry) */
+         cm_retry(&obj->cm, ++attempts, key);
+         if (cm_rewalk()) node = entry;
          continue;
       }
-      node = next;
+      node = succ;
    }
+   if (0 != attempts) cm_done(&obj->cm, attempts);
    return result;
 }
 
+/**
+ * sl_scan() - range scan of the data layer
+ * @obj  - the enclave
+ * @key  - the first key of the scan
+ * @len  - the number of live keys to visit
+ * @hops - incremented by the number of data layer nodes visited
+ *
+ * Returns the number of live keys visited.
+ */
+int sl_scan(enclave* obj, sl_key_t key, int len, unsigned long* hops) {
+   if (NULL != obj->frozen) return fz_scan(obj->frozen, key, len, hops);
+   node_t* node = sl_entry(obj, key);
+   val_t node_val;
+   int found = 0;
+   while (node == node->val) node = node->prev;
+   while (NULL != node && found < len) {
+      node_val = node->val;
+      if (node->seg && node != node_val && DL_MOVING != node_val) {
+         found += cold_scan((cold_block*)node_val, key, len - found);
+      } else if (node->key >= key && NULL != node_val && node != node_val && DL_MOVING != node_val) {
+         found++;
+      }
+      node = node->next;
+      (*hops)++;
+      if (vn_charging) vn_access(obj->get_socket_num(), node, &obj->vn);
+   }
+   return found;
+}
+
 /**
  * sl_do_operation() - performs data layer operations
  * @obj    - the enclave
  * @key    - the search key
  * @optype - the type of operation this is
  * @pnode  - pointer to node if operation is insert
+ *
+ * Returns SL_ELIMINATED if the update succeeded without changing the data layer.
  */
-int sl_do_operation(enclave* obj, uint key, sl_optype_t otype, node_t** pnode) {
+int sl_do_operation(enclave* obj, sl_key_t key, sl_optype_t otype, node_t** pnode) {
    val_t val = (val_t)((long)key);
-   node_t* node = sl_traverse_index(obj, key);
-   int result = sl_traverse_data(obj, node, otype, key, val, pnode);
+   if (NULL != obj->frozen) {
+      assert(CONTAINS == otype);   // the frozen layout is read-only
+      return fz_contains(obj->frozen, key, &val);
+   }
+   if (CONTAINS == otype) {
+      node_t* node = sl_entry(obj, key);
+      return sl_traverse_data(obj, node, otype, key, val, pnode);
+   }
+   int result;
+   sz_begin(obj->size);
+   if (cm_eliminate(&obj->cm, key, INSERT == otype)) {
+      result = SL_ELIMINATED;
+   } else {
+      node_t* node = sl_entry(obj, key);
+      result = sl_traverse_data(obj, node, otype, key, val, pnode);
+   }
+   sz_end(obj->size, INSERT == otype, 0 != result);
    return result;
 }
 
 /**
  * application_loop() - defines the execution flow of the application thread in each enclave
- * @args - the enclave object that owns the application thread
+ *  during the run (returns its results)
+ * @obj - the enclave object that owns the application thread
  */
-void* application_loop(void* args) {
-   enclave*    obj      = (enclave*)args;
+app_res* application_loop(enclave* obj) {
    app_param*  params   = obj->aparams;
    app_res*    lresults = new app_res();
    int         unext    = -1;
-   int         last     = -1;
-   uint        key      =  0;
+   long        last     = -1;
+   sl_key_t    key      =  0;
+   unsigned long ops    =  0;
+   int         since    =  0;
+   op_t        job;
    sl_optype_t otype;
    VOLATILE AO_t *stop  = params->stop;
 
-   // Pin to CPU
-   cpu_set_t cpuset;
-   CPU_ZERO(&cpuset);
-   CPU_SET(obj->get_thread_id(APP_IDX), &cpuset);
-   pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
-   sleep(1);
-
    barrier_cross(params->barrier);
+   rc_online(obj->app_rc);
+   if(obj->lend_depth > 0) {
+      // the run started: the helper thread may lend itself to readers
+      AO_nop_full();
+      obj->lend_params = params;
+   }
    /* Is the first op an update? */
    unext = (rand_range_re(&params->seed, 100) - 1 < params->update);
 
@@ -323,14 +502,14 @@ void* application_loop(void* args) {
       // Obtain the key for the next operation
       if(unext) { // update
          if (last < 0) { // add
-            key = rand_range_re(&params->seed, params->range);
+            key = next_key(params, ops, obj->get_enclave_num());
             otype = INSERT;
          } else { // remove
+            otype = DELETE;
             if (params->alternate) { // alternate mode (default)
                key = last;
-               otype = DELETE;
             } else {
-               key = rand_range_re(&params->seed, params->range);
+               key = next_key(params, ops, obj->get_enclave_num());
             }
          }
       } else { // read
@@ -341,61 +520,122 @@ void* application_loop(void* args) {
             		key = params->first;
             		last = key;
             	} else {
-            	   key = rand_range_re(&params->seed, params->range);
+            	   key = next_key(params, ops, obj->get_enclave_num());
                   last = -1;
             	}
             } else { // update != 0
                if(last < 0) {
-                  key = rand_range_re(&params->seed, params->range);
+                  key = next_key(params, ops, obj->get_enclave_num());
                } else {
                   key = last;
                }
             }
          } else {
-            key = rand_range_re(&params->seed, params->range);
+            key = next_key(params, ops, obj->get_enclave_num());
          }
       }
       node_t* pnode = NULL;
-      int result = sl_do_operation(obj, key, otype, &pnode);
+      int result;
+      if(CONTAINS == otype && params->scan > 0) {
+         result = sl_scan(obj, key, params->scan, &lresults->scan_hops);
+         lresults->scans++;
+         lresults->scanned += result;
+         result = (result > 0);
+      } else if(ops % LAT_SAMPLE == 0) {
+         struct timespec t0, t1;
+         clock_gettime(CLOCK_MONOTONIC, &t0);
+         result = sl_do_operation(obj, key, otype, &pnode);
+         clock_gettime(CLOCK_MONOTONIC, &t1);
+         long ns = (t1.tv_sec - t0.tv_sec) * 1000000000L + (t1.tv_nsec - t0.tv_nsec);
+         unsigned long* lat = (CONTAINS == otype) ? lresults->lat : lresults->ulat;
+         lat[ns / LAT_NS < LAT_BUCKETS ? ns / LAT_NS : LAT_BUCKETS - 1]++;
+      } else {
+         result = sl_do_operation(obj, key, otype, &pnode);
+      }
+      ops++;
 #ifdef COUNT_TRAVERSAL
       obj->total_ops++;
 #endif
+      bool publish = (result && otype != CONTAINS);
+      if(SL_ELIMINATED == result) {
+         // succeeded, but the intermediate layer has nothing to learn
+         result  = 1;
+         publish = false;
+      }
       last = update_results(otype, lresults, result, key, last, params->alternate);
-      if(result && otype != CONTAINS) {
+      if(publish) {
          while(!obj->opbuffer_insert(key, pnode)){
             printf("Waiting to insert...\n");
             exit(-1);
          }
+         if(INSERT == otype && NULL != obj->pending) obj->pt_add(key, pnode);
       }
       unext = get_unext(params, lresults);
+      rc_quiescent(obj->app_rc);
+      if(obj->inline_ops > 0 && ++since == obj->inline_ops) {
+         // no helper thread: maintain the intermediate and index layers here
+         since = 0;
+         helper_pass(obj, &job, true);
+      }
    }
+   rc_offline(obj->app_rc);
    return lresults;
 }
 
+/**
+ * lend_reads() - run contains operations on the helper thread, lent to the readers
+ * @obj    - the enclave
+ * @params - the lent reader's parameters (a copy of the application thread's, with its own seed)
+ * @num    - the number of operations
+ *
+ * Returns false once the run is stopped.
+ *
+ * Note: a lent reader shares the enclave's index layers read-only. It neither samples
+ *  remote accesses for migration nor enters through the application thread's fresh inserts,
+ *  which are the application thread's own state.
+ */
+bool lend_reads(enclave* obj, app_param* params, int num) {
+   app_res* res = obj->lent;
+   val_t val;
+   node_t* pnode = NULL;
+   for(int i = 0; i < num; ++i) {
+      if(AO_load_full(params->stop) != 0) return false;
+      sl_key_t key = next_key(params, res->contains, obj->get_enclave_num());
+      int result;
+      if(NULL != obj->frozen) {
+         result = fz_contains(obj->frozen, key, &val);
+      } else {
+         node_t* node = sl_traverse_index(obj, key);
+         result = sl_traverse_data(obj, node, CONTAINS, key, (val_t)((long)key), &pnode);
+      }
+      res->contains++;
+      if(1 == result) res->found++;
+      rc_quiescent(obj->lend_rc);
+   }
+   return true;
+}
+
 /**
  * initial_populate() - performs initial population from local enclave
- * @args - the enclave object that owns the application thread
+ * @obj - the enclave object that owns the application thread
  */
-void* initial_populate(void* args) {
-   enclave*    obj      = (enclave*)args;
+void initial_populate(enclave* obj) {
    init_param* params   = obj->iparams;
 
-   // Pin to CPU
-   cpu_set_t cpuset;
-   CPU_ZERO(&cpuset);
-   CPU_SET(obj->get_thread_id(APP_IDX), &cpuset);
-   pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
-   sleep(1);
+   rc_online(obj->app_rc);
 
-   int i = 0;
+   long i = 0;
+   op_t job;
    while(i < obj->num_populate) {
       node_t* pnode = NULL;
-      int key = rand_range_re(&params->seed, params->range);
+      sl_key_t key = rand_range_re(&params->seed, params->range);
       if(sl_do_operation(obj, key, INSERT, &pnode)) {
          i++;
          *params->last = key;
          while(!obj->opbuffer_insert(key, pnode)){}
+         if(obj->inline_ops > 0 && i % obj->inline_ops == 0) helper_pass(obj, &job, true);
       }
+      rc_quiescent(obj->app_rc);
    }
-   return NULL;
+   rc_offline(obj->app_rc);
 }
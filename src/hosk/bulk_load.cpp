@@ -0,0 +1,484 @@
+/*
+ * bulk_load.cpp: parallel bulk load of an empty skip list
+ *
+ * Author: Henry Daly, 2018
+ */
+
+/**
+ * Module Overview:
+ *
+ * Initial population inserts random keys one at a time from every enclave, after which
+ * the helpers throw the index layers away and raise them again pass after pass. A bulk
+ * load builds the same structure directly instead. Each step runs on the application
+ * threads of all enclaves (as an EN_BULK phase), and the main thread waits for all of
+ * them between two steps:
+ *    - BL_SORT/BL_MERGE: a sample sort. Enclave i sorts slice i of the keys, the main
+ *      thread picks splitters from samples of the sorted slices, and enclave i merges the
+ *      runs of bucket i of all slices (skipped if the keys are given sorted, which only
+ *      splits them into buckets). Equal keys fall into the same bucket, so each bucket
+ *      drops its duplicate keys on its own.
+ *    - BL_LINK: enclave i allocates the data layer nodes of bucket i (a contiguous key
+ *      range, so with the default placement each range of the data layer sits on the NUMA
+ *      zone of one enclave) and links them in a single pass. The main thread then links
+ *      the buckets together.
+ *    - BL_INDEX: enclave i indexes every num_enclaves-th key, as many as initial
+ *      population gives each enclave, at the density the helper converges to: the n-th
+ *      intermediate node is raised to level ctz(n), so each index level holds every other
+ *      node of the level below.
+ *
+ * The skip list must be empty and its helpers not started yet.
+ *
+ * bl_validate() checks a skip list of any size the same way, enclave i walking its own
+ * intermediate and index layers and the data layer of slice i of the key range (entered
+ * through its own index), so that a large-scale run is checked in parallel rather than by
+ * a walk of the whole data layer on the main thread. The same walks can count the data
+ * layer nodes for the memory report.
+ */
+
+#include <algorithm>
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bulk_load.h"
+#include "cold.h"
+#include "enclave.h"
+#include "learned_index.h"
+#include "mem_account.h"
+
+/* key_less()/key_equal()/key_below() - compare pairs by key */
+static bool key_less(const bl_pair& a, const bl_pair& b) {
+   return a.key < b.key;
+}
+static bool key_equal(const bl_pair& a, const bl_pair& b) {
+   return a.key == b.key;
+}
+static bool key_below(const bl_pair& a, sl_key_t key) {
+   return a.key < key;
+}
+
+/* slice_lo() - the first key of slice @i of the unsorted keys */
+static long slice_lo(bl_job* job, int i) {
+   return i * job->num / job->num_enclaves;
+}
+
+/* bl_step() - run @step on all enclaves and wait for them */
+static void bl_step(enclave** enclaves, bl_job* job, int step) {
+   job->step = step;
+   for(int i = 0; i < job->num_enclaves; ++i) {
+      enclaves[i]->bulk_begin(job);
+   }
+   for(int i = 0; i < job->num_enclaves; ++i) {
+      enclaves[i]->bulk_end();
+   }
+}
+
+/**
+ * generate() - draw enclave @i's share of distinct random keys from its slice of the range
+ *  (sequential sampling: each key of the slice is taken with probability keys needed / keys
+ *  left, the keys passed over before the next one taken being drawn at once, so a sparse
+ *  slice costs one draw per key rather than one per key of the range)
+ * @job - the bulk load
+ * @i   - the enclave
+ */
+static void generate(bl_job* job, int i) {
+   int  n     = job->num_enclaves;
+   long d     = job->num / n;
+   long m     = job->num % n;
+   long first = i * d + (i < m ? i : m);
+   long key   = range_slice(job->range, n, i);
+   long hi    = range_slice(job->range, n, i + 1);
+   long need  = d + (i < m ? 1 : 0);
+   uint seed  = job->seed + i;
+   for(long j = 0; j < need; ++j, ++key) {
+      long left = hi - key;
+      if(need - j < left) {
+         double p = (double)(need - j) / left;
+         double u = (rand_r(&seed) + 1.0) / (RAND_MAX + 2.0);
+         long skip = (long)(log(u) / log(1.0 - p));
+         key += skip < left - (need - j) ? skip : left - (need - j);
+      }
+      // unsorted: the keys of the enclaves are interleaved
+      long at = job->sorted ? first + j : j * n + i;
+      job->pairs[at].key = key;
+      job->pairs[at].val = (val_t)key;
+   }
+}
+
+/* sort_slice() - sort slice @i of the unsorted keys */
+static void sort_slice(bl_job* job, int i) {
+   std::sort(job->input + slice_lo(job, i), job->input + slice_lo(job, i + 1), key_less);
+}
+
+/* pick_splitters() - pick the bucket splitters from samples of the sorted slices */
+static void pick_splitters(bl_job* job) {
+   int n = job->num_enclaves;
+   sl_key_t* samples = (sl_key_t*)malloc(n * BL_SAMPLES * sizeof(sl_key_t));
+   int num_samples = 0;
+   for(int i = 0; i < n; ++i) {
+      long lo = slice_lo(job, i);
+      long len = slice_lo(job, i + 1) - lo;
+      if(0 == len) continue;
+      for(int s = 0; s < BL_SAMPLES; ++s) {
+         samples[num_samples++] = job->input[lo + s * len / BL_SAMPLES].key;
+      }
+   }
+   std::sort(samples, samples + num_samples);
+   for(int b = 0; b < n - 1; ++b) {
+      job->splitters[b] = samples[(b + 1) * num_samples / n];
+   }
+   free(samples);
+}
+
+/* merge_bucket() - gather the runs of bucket @b from all sorted slices and merge them */
+static void merge_bucket(bl_job* job, int b) {
+   int   n    = job->num_enclaves;
+   long* runs = (long*)malloc((n + 1) * sizeof(long));
+   long  at   = 0;
+   bl_pair** from = (bl_pair**)malloc(2 * n * sizeof(bl_pair*));
+   for(int s = 0; s < n; ++s) {
+      bl_pair* lo = job->input + slice_lo(job, s);
+      bl_pair* hi = job->input + slice_lo(job, s + 1);
+      from[2 * s]     = (0 == b)     ? lo : std::lower_bound(lo, hi, job->splitters[b - 1], key_below);
+      from[2 * s + 1] = (n - 1 == b) ? hi : std::lower_bound(lo, hi, job->splitters[b], key_below);
+      // the buckets before this one take the keys of the slice before its run
+      at += from[2 * s] - lo;
+   }
+   job->bounds[b] = at;
+   for(int s = 0; s < n; ++s) {
+      long len = from[2 * s + 1] - from[2 * s];
+      runs[s] = at;
+      memcpy(job->pairs + at, from[2 * s], len * sizeof(bl_pair));
+      at += len;
+   }
+   runs[n] = job->ends[b] = at;
+   for(int width = 1; width < n; width *= 2) {
+      for(int s = 0; s + width < n; s += 2 * width) {
+         int end = (s + 2 * width < n) ? s + 2 * width : n;
+         std::inplace_merge(job->pairs + runs[s], job->pairs + runs[s + width],
+                            job->pairs + runs[end], key_less);
+      }
+   }
+   free(from);
+   free(runs);
+}
+
+/* dedup_bucket() - drop the duplicate keys (and the reserved key 0) of bucket @b */
+static void dedup_bucket(bl_job* job, int b) {
+   bl_pair* lo  = job->pairs + job->bounds[b];
+   bl_pair* end = std::unique(lo, job->pairs + job->ends[b], key_equal);
+   while(lo < end && 0 == lo->key) lo++;
+   job->bounds[b] = lo - job->pairs;
+   job->ends[b]   = end - job->pairs;
+}
+
+/**
+ * link_bucket() - allocate and link the data layer nodes of bucket @i
+ * @obj - the enclave object
+ * @job - the bulk load
+ * @i   - the bucket
+ */
+static void link_bucket(enclave* obj, bl_job* job, int i) {
+   node_t* prev = NULL;
+   for(long k = job->bounds[i]; k < job->ends[i]; ++k) {
+      node_t* node = node_new(job->pairs[k].key, job->pairs[k].val, prev, NULL);
+      if(NULL != prev) prev->next = node;
+      job->pairs[k].val = (val_t)node;
+      prev = node;
+   }
+   obj->size->inserts += job->ends[i] - job->bounds[i];
+}
+
+/**
+ * build_index() - build the intermediate and index layers of enclave @i over every
+ *  num_enclaves-th key of the linked data layer
+ * @obj - the enclave object
+ * @job - the bulk load
+ * @i   - the enclave
+ */
+static void build_index(enclave* obj, bl_job* job, int i) {
+   int      n        = job->num_enclaves;
+   long     total    = job->offsets[n];
+   long     count    = (total > i) ? (total - i + n - 1) / n : 0;
+   inode_t* sentinel = obj->get_sentinel();
+   mnode_t* mprev    = sentinel->intermed;
+   inode_t* last[MAX_LEVELS];
+   assert(NULL == mprev->next && NULL == sentinel->right && NULL == sentinel->down);
+
+   // the sentinel's tower is one level above the tallest node
+   uint height = 1;
+   for(long c = count; c > 1; c >>= 1) height++;
+   assert(height < MAX_LEVELS);
+   last[0] = sentinel;
+   for(uint l = 1; l < height; ++l) {
+      last[l] = inode_new(NULL, last[l - 1], mprev, i);
+   }
+   mprev->level = height;
+   if(mprev->node->level < height) mprev->node->level = height;
+   obj->set_sentinel(last[height - 1]);
+
+   int  b    = 0;
+   long rank = 0;
+   for(long p = i; p < total; p += n) {
+      while(p >= job->offsets[b + 1]) b++;
+      node_t*  node   = (node_t*)job->pairs[job->bounds[b] + p - job->offsets[b]].val;
+      uint     level  = __builtin_ctzl(++rank);
+      mnode_t* mnode  = mnode_new(NULL, node, level, i);
+      mprev->next = mnode;
+      mprev = mnode;
+      if(node->level < level) node->level = level;
+      inode_t* down = NULL;
+      for(uint l = 0; l < level; ++l) {
+         last[l]->right = inode_new(NULL, down, mnode, i);
+         down = last[l] = last[l]->right;
+      }
+   }
+   obj->size->indexed += count;
+   if(obj->learned) obj->model = model_build(obj->get_sentinel()->intermed);
+}
+
+/* live_keys() - the number of keys held by a linked data layer node (see data_layer_size()) */
+static long live_keys(node_t* node) {
+   val_t val = node->val;
+   if(node->seg && node != val && DL_MOVING != val) return ((cold_block*)val)->live;
+   return (NULL != val && node != val && DL_MOVING != val) ? 1 : 0;
+}
+
+/* check_index() - count the keys of enclave @i's intermediate layer and the violations of its layers */
+static long check_index(enclave* obj, bl_job* job, int i) {
+   long     errors   = 0;
+   long     indexed  = 0;
+   inode_t* sentinel = obj->get_sentinel();
+   for(mnode_t* mnode = sentinel->intermed; NULL != mnode->next; mnode = mnode->next) {
+      if(mnode->next->key <= mnode->key) errors++;
+      if(!mnode->next->marked) indexed++;
+   }
+   for(inode_t* level = sentinel; NULL != level; level = level->down) {
+      for(inode_t* inode = level; NULL != inode; inode = inode->right) {
+         if(inode->key != inode->intermed->key) errors++;
+         if(NULL != inode->right && inode->right->key <= inode->key) errors++;
+         if(NULL != inode->down && inode->down->intermed != inode->intermed) errors++;
+      }
+   }
+   job->indexed[i] = indexed;
+   return errors;
+}
+
+/**
+ * check_slice() - count the live keys of slice @i of the key range and the ordering
+ *  violations of its data layer nodes
+ * @obj - the enclave object (whose index layer finds the start of the slice)
+ * @job - the validation
+ * @i   - the slice
+ */
+static long check_slice(enclave* obj, bl_job* job, int i) {
+   int      n       = job->num_enclaves;
+   sl_key_t lo      = (0 == i) ? 0 : range_slice(job->range, n, i);
+   sl_key_t hi      = range_slice(job->range, n, i + 1);
+   long*    zones   = job->zones + i * NP_MAX_ZONES;
+   ma_report* data  = (NULL != job->data) ? &job->data[i] : NULL;
+   long     errors  = 0;
+   long     keys    = 0;
+   bool     started = false;
+   bool     counted = false;
+   sl_key_t prev = 0, prev_live = 0;
+   node_t*  node = bg_find_mnode(obj, lo)->node;
+   while(node == node->val) node = node->prev;   // the entry is being removed
+   for(; NULL != node; node = node->next) {
+      if(0 == node->key) {
+         // deletion markers (counted by the slice of the node they follow)
+         if(started && NULL != data) ma_count_node(data, node);
+         continue;
+      }
+      if(!started && node->key < lo) continue;
+      // (the last slice also holds any key past the range)
+      if(n - 1 != i && node->key >= hi) break;
+      if(started && node->key < prev) errors++;
+      started = true;
+      prev = node->key;
+      if(NULL != data) ma_count_node(data, node);
+      long live = live_keys(node);
+      if(0 == live) continue;
+      if(counted && node->key <= prev_live) errors++;
+      counted = true;
+      prev_live = node->key;
+      keys += live;
+      zones[np_node_zone((void*)node)] += live;
+   }
+   job->keys[i] = keys;
+   return errors;
+}
+
+/* bl_run() - run the current step of the enclave's bulk load (on its application thread) */
+void bl_run(enclave* obj) {
+   bl_job* job = obj->bulk;
+   int i = obj->get_enclave_num();
+   switch(job->step) {
+      case BL_GENERATE:
+         generate(job, i);
+         break;
+      case BL_SORT:
+         sort_slice(job, i);
+         break;
+      case BL_MERGE:
+         if(!job->sorted) merge_bucket(job, i);
+         dedup_bucket(job, i);
+         break;
+      case BL_LINK:
+         link_bucket(obj, job, i);
+         break;
+      case BL_INDEX:
+         build_index(obj, job, i);
+         break;
+      case BL_VALIDATE:
+         job->errors[i] = check_index(obj, job, i) + check_slice(obj, job, i);
+         break;
+   }
+}
+
+/**
+ * bl_random() - generate @num distinct random keys of [1, @range] in parallel (valued as
+ *  the benchmark's inserts), each enclave drawing from its own slice of the range
+ * @enclaves     - all enclaves
+ * @num_enclaves - the number of enclaves
+ * @num          - the number of keys
+ * @range        - the key range
+ * @seed         - the random seed
+ * @sorted       - return the keys in order (else the slices of the enclaves are interleaved)
+ */
+bl_pair* bl_random(enclave** enclaves, int num_enclaves, long num, long range, uint seed, bool sorted) {
+   if(range / num_enclaves < num / num_enclaves + 1) {
+      printf("ERROR: bulk load of %ld keys needs a range of at least %ld\n", num,
+             (num / num_enclaves + 1) * num_enclaves);
+      exit(1);
+   }
+   bl_job job;
+   memset(&job, 0, sizeof(bl_job));
+   job.num_enclaves = num_enclaves;
+   job.num    = num;
+   job.range  = range;
+   job.seed   = seed;
+   job.sorted = sorted;
+   job.pairs  = (bl_pair*)malloc(num * sizeof(bl_pair));
+   bl_step(enclaves, &job, BL_GENERATE);
+   return job.pairs;
+}
+
+/**
+ * bl_load() - load keys into the empty skip list (before its helpers are started)
+ * @enclaves     - all enclaves
+ * @num_enclaves - the number of enclaves
+ * @head         - the data layer sentinel
+ * @pairs        - the keys and their values (overwritten)
+ * @num          - the number of keys
+ * @sorted       - the keys are in order (else they are sorted in parallel)
+ *
+ * Returns the number of distinct keys loaded.
+ */
+long bl_load(enclave** enclaves, int num_enclaves, node_t* head, bl_pair* pairs, long num, bool sorted) {
+   int n = num_enclaves;
+   assert(NULL == head->next);
+   bl_job job;
+   memset(&job, 0, sizeof(bl_job));
+   job.num_enclaves = n;
+   job.num       = num;
+   job.sorted    = sorted;
+   job.bounds    = (long*)malloc((n + 1) * sizeof(long));
+   job.ends      = (long*)malloc((n + 1) * sizeof(long));
+   job.offsets   = (long*)malloc((n + 1) * sizeof(long));
+   if(sorted) {
+      // even buckets, each one starting after the copies of the last key of the one before
+      job.pairs = pairs;
+      for(int b = 0; b < n; ++b) {
+         long lo = b * num / n;
+         if(b > 0 && lo < job.bounds[b - 1]) lo = job.bounds[b - 1];
+         while(lo > 0 && lo < num && pairs[lo].key == pairs[lo - 1].key) lo++;
+         job.bounds[b] = lo;
+      }
+      for(int b = 0; b < n; ++b) {
+         job.ends[b] = (b < n - 1) ? job.bounds[b + 1] : num;
+      }
+   } else {
+      job.input     = pairs;
+      job.pairs     = (bl_pair*)malloc(num * sizeof(bl_pair));
+      job.splitters = (sl_key_t*)malloc(n * sizeof(sl_key_t));
+      bl_step(enclaves, &job, BL_SORT);
+      pick_splitters(&job);
+   }
+   bl_step(enclaves, &job, BL_MERGE);
+   job.offsets[0] = 0;
+   for(int b = 0; b < n; ++b) {
+      job.offsets[b + 1] = job.offsets[b] + job.ends[b] - job.bounds[b];
+   }
+
+   bl_step(enclaves, &job, BL_LINK);
+   // link the buckets in key order
+   node_t* prev = head;
+   for(int b = 0; b < n; ++b) {
+      if(job.ends[b] == job.bounds[b]) continue;
+      node_t* first = (node_t*)job.pairs[job.bounds[b]].val;
+      first->prev = prev;
+      prev->next  = first;
+      prev = (node_t*)job.pairs[job.ends[b] - 1].val;
+   }
+
+   bl_step(enclaves, &job, BL_INDEX);
+   long loaded = job.offsets[n];
+   if(!sorted) {
+      free(job.pairs);
+      free(job.splitters);
+   }
+   free(job.bounds);
+   free(job.ends);
+   free(job.offsets);
+   return loaded;
+}
+
+/**
+ * bl_validate() - check the layers of the skip list in parallel (no thread may update it meanwhile)
+ * @enclaves     - all enclaves
+ * @num_enclaves - the number of enclaves
+ * @range        - the key range (split into the enclaves' slices)
+ * @indexed      - set to the number of keys in the intermediate layers
+ * @zones        - live data layer nodes added by NUMA zone (NULL to skip)
+ * @mem          - data layer nodes added by kind, as ma_collect() counts them (NULL to skip)
+ *
+ * Returns the number of keys in the set, or -1 if a layer is out of order.
+ */
+long bl_validate(enclave** enclaves, int num_enclaves, long range, long* indexed, long* zones, ma_report* mem) {
+   int n = num_enclaves;
+   bl_job job;
+   memset(&job, 0, sizeof(bl_job));
+   job.num_enclaves = n;
+   job.range   = range;
+   job.keys    = (long*)calloc(n, sizeof(long));
+   job.indexed = (long*)calloc(n, sizeof(long));
+   job.errors  = (long*)calloc(n, sizeof(long));
+   job.zones   = (long*)calloc(n * NP_MAX_ZONES, sizeof(long));
+   job.data    = (NULL != mem) ? (ma_report*)calloc(n, sizeof(ma_report)) : NULL;
+   bl_step(enclaves, &job, BL_VALIDATE);
+
+   long keys = 0;
+   bool valid = true;
+   *indexed = 0;
+   for(int i = 0; i < n; ++i) {
+      if(job.errors[i] > 0) {
+         printf("ERROR: enclave %d: %ld violations of the key order\n", i, job.errors[i]);
+         valid = false;
+      }
+      keys     += job.keys[i];
+      *indexed += job.indexed[i];
+      for(int z = 0; NULL != zones && z < NP_MAX_ZONES; ++z) {
+         zones[z] += job.zones[i * NP_MAX_ZONES + z];
+      }
+      if(NULL != mem) ma_add_data(mem, &job.data[i]);
+   }
+   if(NULL != mem) mem->markers++;   // the sentinel
+   free(job.keys);
+   free(job.indexed);
+   free(job.errors);
+   free(job.zones);
+   free(job.data);
+   return valid ? keys : -1;
+}
@@ -0,0 +1,60 @@
+/*
+ * Interface for the parallel bulk load
+ *
+ * Author: Henry Daly, 2018
+ */
+#ifndef BULK_LOAD_H_
+#define BULK_LOAD_H_
+
+#include "common.h"
+#include "node_pool.h"
+#include "skiplist.h"
+
+#define BL_SAMPLES   64     // keys sampled from each sorted slice to pick the bucket splitters
+
+class enclave;
+struct ma_report;
+
+/* bl_pair is a key and its value to load */
+struct bl_pair {
+   sl_key_t       key;
+   val_t          val;        // replaced by the key's data layer node once it is linked
+};
+
+/* steps of a bulk load, each one run by the application threads of all enclaves */
+enum bl_step {
+   BL_GENERATE,      // generate random keys (bl_random())
+   BL_SORT,          // sort a slice of the keys
+   BL_MERGE,         // merge the slices' runs of a bucket of keys and drop duplicate keys
+   BL_LINK,          // allocate and link the data layer nodes of a bucket
+   BL_INDEX,         // build the enclave's intermediate and index layers
+   BL_VALIDATE       // check the enclave's layers and the data layer of its slice of the key range
+};
+
+/* bl_job is a bulk load shared by the enclaves (enclave i works on slice and bucket i) */
+struct bl_job {
+   int            step;
+   int            num_enclaves;
+   bl_pair*       pairs;      // the keys (sorted by buckets from BL_MERGE on)
+   bl_pair*       input;      // the unsorted keys (NULL if they were given sorted)
+   long           num;
+   bool           sorted;
+   sl_key_t*      splitters;  // bucket i holds the keys in [splitters[i-1], splitters[i])
+   long*          bounds;     // bucket i holds pairs[bounds[i]] to pairs[ends[i]-1]
+   long*          ends;
+   long*          offsets;    // number of distinct keys in the buckets before bucket i
+   long           range;      // keys are drawn from [1, range] (BL_GENERATE) and split into slices (BL_VALIDATE)
+   uint           seed;
+   long*          keys;       // BL_VALIDATE, per enclave: live keys of its slice
+   long*          indexed;    //    keys in its intermediate layer
+   long*          errors;     //    ordering and index layer violations found
+   long*          zones;      //    live data layer nodes of its slice, by NUMA zone
+   ma_report*     data;       //    data layer nodes of its slice, by kind (NULL: not counted)
+};
+
+bl_pair* bl_random(enclave** enclaves, int num_enclaves, long num, long range, uint seed, bool sorted);
+long     bl_load(enclave** enclaves, int num_enclaves, node_t* head, bl_pair* pairs, long num, bool sorted);
+long     bl_validate(enclave** enclaves, int num_enclaves, long range, long* indexed, long* zones, ma_report* mem);
+void     bl_run(enclave* obj);
+
+#endif /* BULK_LOAD_H_ */
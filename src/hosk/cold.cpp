@@ -0,0 +1,454 @@
+/*
+ * cold.cpp: immutable compressed cold segments of the data layer
+ *
+ * Author: Henry Daly, 2018
+ */
+
+/**
+ * Module Overview:
+ *
+ * Every helper thread counts the updates it publishes per bucket of the key range. Once
+ * per maintenance round, the helper which owns a slice of the key range (see migrate.cpp)
+ * sums those counters over all enclaves for each bucket of its slice; a bucket which saw
+ * no update for the configured number of rounds is cold, and its runs of ordinary data
+ * layer nodes are absorbed into segments of up to COLD_SEG_KEYS keys.
+ *
+ * A segment is a single data layer node (seg set) whose value is an immutable block of
+ * delta-encoded entries. A run N1..Nk is absorbed much like a node is migrated: the
+ * segment node S, with the value DL_MOVING, is linked right after N1; N2..Nk are frozen
+ * and unlinked one by one (operations which reach S meanwhile wait, except those on N1's
+ * key, which act on N1), then N1 is frozen, the block is published in S and N1 is
+ * unlinked. The absorbed nodes are retired like migrated ones.
+ *
+ * Lookups which end on a segment search its block in place. Any update of a key covered
+ * by a segment first splits it: the updating application thread rebuilds the ordinary
+ * nodes from the block, links them right after S in a single CAS, freezes S and hands
+ * the block back to the helper of the enclave which built it, which unlinks S, retires
+ * it and updates its own segment counters. Since a block keeps logically
+ * deleted keys, a split restores every key the segment absorbed, and a key never loses
+ * its data layer node (which repointing the intermediate layers relies on).
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "cold.h"
+#include "enclave.h"
+#include "migrate.h"
+
+static int      cold_rounds = 0;   // quiet rounds which make a bucket cold (0 = no segments)
+static sl_key_t bucket_width = 1;
+
+/* cold_init() - enable cold segments over keys [0, @range] */
+void cold_init(long range, int rounds) {
+   cold_rounds  = rounds;
+   bucket_width = range / COLD_BUCKETS + 1;
+}
+
+/* block layout accessors */
+static inline sl_key_t* restart_keys(cold_block* b) {
+   return (sl_key_t*)(b + 1);
+}
+static inline unsigned* restart_offs(cold_block* b) {
+   return (unsigned*)(restart_keys(b) + b->num_restarts);
+}
+static inline unsigned char* entries(cold_block* b) {
+   return (unsigned char*)(restart_offs(b) + b->num_restarts);
+}
+
+/* varint_len()/put_varint()/get_varint() - LEB128 encoding */
+static inline int varint_len(unsigned long v) {
+   int len = 1;
+   while(v >= 0x80) { v >>= 7; len++; }
+   return len;
+}
+static inline unsigned char* put_varint(unsigned char* p, unsigned long v) {
+   while(v >= 0x80) {
+      *p++ = (unsigned char)(v | 0x80);
+      v >>= 7;
+   }
+   *p++ = (unsigned char)v;
+   return p;
+}
+static inline unsigned long get_varint(const unsigned char** p) {
+   unsigned long v = 0;
+   int shift = 0;
+   while(**p & 0x80) {
+      v |= (unsigned long)(*(*p)++ & 0x7f) << shift;
+      shift += 7;
+   }
+   v |= (unsigned long)(*(*p)++) << shift;
+   return v;
+}
+
+/* zigzag()/unzigzag() - map the signed distance between a value and its key to small codes */
+static inline unsigned long zigzag(sl_key_t key, val_t val) {
+   long d = (long)val - (long)key;
+   return ((unsigned long)d << 1) ^ (unsigned long)(d >> 63);
+}
+static inline val_t unzigzag(sl_key_t key, unsigned long z) {
+   long d = (long)(z >> 1) ^ -(long)(z & 1);
+   return (val_t)((long)key + d);
+}
+
+/**
+ * block_encode() - build the block of @n entries
+ * @keys - the keys (ascending)
+ * @vals - their values (NULL if logically deleted)
+ */
+static cold_block* block_encode(sl_key_t* keys, val_t* vals, int n) {
+   int num_restarts = (n + COLD_RESTART - 1) / COLD_RESTART;
+   int data = 0;
+   for(int i = 0; i < n; ++i) {
+      data += varint_len(i ? keys[i] - keys[i - 1] : 0) + varint_len(zigzag(keys[i], vals[i]));
+   }
+   int bytes = sizeof(cold_block) + num_restarts * (sizeof(sl_key_t) + sizeof(unsigned)) + data;
+   cold_block* b = (cold_block*)malloc(bytes);
+   b->link         = NULL;
+   b->node         = NULL;
+   b->splitting    = 0;
+   b->last         = keys[n - 1];
+   b->count        = n;
+   b->live         = 0;
+   b->num_restarts = num_restarts;
+   b->bytes        = bytes;
+
+   unsigned char* p = entries(b);
+   for(int i = 0; i < n; ++i) {
+      if(i % COLD_RESTART == 0) {
+         restart_keys(b)[i / COLD_RESTART] = keys[i];
+         restart_offs(b)[i / COLD_RESTART] = p - entries(b);
+      }
+      p = put_varint(p, i ? keys[i] - keys[i - 1] : 0);
+      p = put_varint(p, zigzag(keys[i], vals[i]));
+      if(NULL != vals[i]) b->live++;
+   }
+   assert(p == (unsigned char*)b + bytes);
+   return b;
+}
+
+/* block_free() - free a split block and its segment node */
+static void block_free(void* ptr, int unused) {
+   cold_block* b = (cold_block*)ptr;
+   dl_node_free((void*)b->node, 0);
+   free(b);
+}
+
+/* block_seek() - first restart point of the block to decode for keys >= @key */
+static inline int block_seek(cold_block* b, sl_key_t key) {
+   int lo = 0, hi = b->num_restarts - 1;
+   sl_key_t* rk = restart_keys(b);
+   while(lo < hi) {
+      int mid = (lo + hi + 1) / 2;
+      if(rk[mid] <= key) lo = mid;
+      else               hi = mid - 1;
+   }
+   return lo;
+}
+
+/**
+ * cold_find() - search a block in place
+ * @b   - the block
+ * @key - the search key
+ * @val - set to the value of @key (NULL if logically deleted)
+ * returns true if the block has an entry for @key
+ */
+bool cold_find(cold_block* b, sl_key_t key, val_t* val) {
+   int r = block_seek(b, key);
+   const unsigned char* p = entries(b) + restart_offs(b)[r];
+   sl_key_t k = restart_keys(b)[r];
+   int end = (r + 1) * COLD_RESTART;
+   if(end > b->count) end = b->count;
+   for(int i = r * COLD_RESTART; i < end; ++i) {
+      unsigned long delta = get_varint(&p);
+      if(i % COLD_RESTART) k += delta;
+      unsigned long z = get_varint(&p);
+      if(k == key) {
+         *val = unzigzag(k, z);
+         return true;
+      }
+      if(k > key) break;
+   }
+   return false;
+}
+
+/**
+ * cold_scan() - count the live keys of a block from @from on
+ * @b    - the block
+ * @from - the first key
+ * @len  - the maximum number of keys to count
+ */
+int cold_scan(cold_block* b, sl_key_t from, int len) {
+   int r = block_seek(b, from);
+   const unsigned char* p = entries(b) + restart_offs(b)[r];
+   sl_key_t k = restart_keys(b)[r];
+   int found = 0;
+   for(int i = r * COLD_RESTART; i < b->count && found < len; ++i) {
+      unsigned long delta = get_varint(&p);
+      k = (i % COLD_RESTART) ? k + delta : restart_keys(b)[i / COLD_RESTART];
+      unsigned long z = get_varint(&p);
+      if(k >= from && NULL != unzigzag(k, z)) found++;
+   }
+   return found;
+}
+
+/**
+ * cold_live() - decode the live entries of a block
+ * @b    - the block
+ * @keys - filled with the keys (room for b->live entries)
+ * @vals - filled with their values
+ * returns the number of entries decoded
+ */
+int cold_live(cold_block* b, sl_key_t* keys, val_t* vals) {
+   const unsigned char* p = entries(b);
+   sl_key_t k = 0;
+   int n = 0;
+   for(int i = 0; i < b->count; ++i) {
+      unsigned long delta = get_varint(&p);
+      k = (i > 0) ? k + delta : restart_keys(b)[0];
+      val_t val = unzigzag(k, get_varint(&p));
+      if(NULL != val) {
+         keys[n] = k;
+         vals[n] = val;
+         n++;
+      }
+   }
+   return n;
+}
+
+/**
+ * cold_split() - split a segment back into ordinary nodes (application thread)
+ * @seg - the segment node
+ * @b   - its block
+ *
+ * Returns at once if another thread is splitting the segment: the segment is still
+ *  linked then, so the caller retries its update until the split is done.
+ */
+void cold_split(node_t* seg, cold_block* b) {
+   if(!CAS(&b->splitting, 0, 1)) return;
+
+   // rebuild the absorbed nodes
+   const unsigned char* p = entries(b);
+   node_t *first = NULL, *last = NULL;
+   sl_key_t k = seg->key;
+   for(int i = 0; i < b->count; ++i) {
+      unsigned long delta = get_varint(&p);
+      if(i > 0) k += delta;
+      node_t* node = node_new(k, unzigzag(k, get_varint(&p)), (i > 0) ? last : seg, NULL);
+      if(i == 0) first = node;
+      else       last->next = node;
+      last = node;
+   }
+
+   // link them after the segment, then remove it
+   node_t* next;
+   do {
+      next = seg->next;
+      last->next = next;
+   } while(!CAS(&seg->next, next, first));
+   if(NULL != next) { next->prev = last; }
+   seg->val = seg;
+   AO_nop_full();
+
+   mig_state* mig = mig_states[b->owner];
+   do {
+      b->link = (cold_block*)mig->thawed;
+   } while(!CAS(&mig->thawed, b->link, b));
+}
+
+/* plain() - an ordinary data layer node (not a segment, a migrating copy or the sentinel) */
+static inline bool plain(node_t* node) {
+   val_t val = node->val;
+   return !node->seg && val != DL_MOVING && val != node && node->prev != NULL;
+}
+
+/**
+ * absorb() - replace the run of ordinary nodes which starts at @first by a segment
+ * @obj   - the enclave object
+ * @first - the first node of the run
+ * @hi    - the first key past the cold range
+ * returns the last key absorbed, 0 if the segment could not be built
+ */
+static sl_key_t absorb(enclave* obj, node_t* first, sl_key_t hi) {
+   sl_key_t keys[COLD_SEG_KEYS];
+   val_t    vals[COLD_SEG_KEYS];
+   node_t*  nodes[COLD_SEG_KEYS];
+   if(!mig_trylock()) return 0;
+   node_t* next = first->next;
+   if(!plain(first) || (NULL != next && (next->val == next || next->val == DL_MOVING))) {
+      mig_unlock();
+      return 0;
+   }
+   node_t* seg = node_new(first->key, DL_MOVING, first, next);
+   seg->seg = true;
+   if(!CAS(&first->next, next, seg)) {
+      mig_unlock();
+      node_delete(seg);
+      return 0;
+   }
+   if(NULL != next) { next->prev = seg; }
+
+   // freeze and unlink the rest of the run
+   int n = 1;
+   val_t val;
+   while(n < COLD_SEG_KEYS) {
+      node_t* node = seg->next;
+      if(NULL == node) break;
+      if(node->val == node) {
+         node_remove(seg, node);
+         continue;
+      }
+      if(node->key >= hi || !plain(node)) {
+         node->prev = seg;   // nothing is inserted after a segment under construction
+         break;
+      }
+      do {
+         val = node->val;
+      } while(!CAS(&node->val, val, node));
+      keys[n]  = node->key;
+      vals[n]  = val;
+      nodes[n] = node;
+      n++;
+      node_remove(seg, node);
+   }
+   do {
+      val = first->val;
+   } while(!CAS(&first->val, val, first));
+   keys[0]  = first->key;
+   vals[0]  = val;
+   nodes[0] = first;
+
+   // publish the block
+   cold_block* b = block_encode(keys, vals, n);
+   b->node  = seg;
+   b->owner = obj->get_enclave_num();
+   BARRIER();
+   seg->val = b;
+   AO_nop_full();
+   mig_unlock();
+
+   dl_unlink(first);
+   mig_request_repoint(keys[0], keys[n - 1]);
+   for(int i = 0; i < n; ++i) {
+      rc_retire_staged(obj->limbo, (void*)nodes[i], dl_node_free, 0, MIG_GRACE_PERIODS);
+   }
+   obj->mig->cold.segments++;
+   obj->mig->cold.keys  += n;
+   obj->mig->cold.bytes += b->bytes;
+   return keys[n - 1];
+}
+
+/**
+ * find_run() - find the next run of at least COLD_MIN_KEYS ordinary nodes in [@from, @hi)
+ * @obj  - the enclave object
+ * @from - the first key to consider (advanced past the nodes skipped)
+ * @hi   - the first key past the range
+ * returns the first node of the run, NULL if there is none
+ */
+static node_t* find_run(enclave* obj, sl_key_t* from, sl_key_t hi) {
+   node_t *node = bg_find_mnode(obj, *from)->node, *next, *first = NULL;
+   int n = 0;
+   while(1) {
+      while(node == node->val) node = node->prev;
+      next = node->next;
+      if(NULL != next && next->val == next) {
+         node_remove(node, next);
+         continue;
+      }
+      if(node->key >= *from && node->key < hi) {
+         if(!plain(node)) {
+            first = NULL;
+            n = 0;
+         } else {
+            if(NULL == first) first = node;
+            if(++n == COLD_MIN_KEYS) return first;
+         }
+         *from = node->key + 1;
+      }
+      if(NULL == next || next->key >= hi) {
+         *from = hi;
+         return NULL;
+      }
+      node = next;
+   }
+}
+
+/**
+ * cold_update() - count an update published by the helper thread
+ * @obj - the enclave object
+ * @key - the updated key
+ */
+void cold_update(enclave* obj, sl_key_t key) {
+   if(cold_rounds > 0) obj->mig->cold_updates[key / bucket_width]++;
+}
+
+/* now_ms() - coarse monotonic clock */
+static inline long now_ms(void) {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+   return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * cold_maintain() - retire split segments and, once per round, turn cold buckets of the
+ *  enclave's slice into segments
+ * @obj - the enclave object
+ */
+void cold_maintain(enclave* obj) {
+   mig_state* mig = obj->mig;
+   if(mig->thawed != 0) {
+      cold_block* b;
+      do {
+         b = (cold_block*)mig->thawed;
+      } while(!CAS(&mig->thawed, b, NULL));
+      while(NULL != b) {
+         cold_block* next = b->link;
+         dl_unlink(b->node);
+         mig_request_repoint(b->node->key, b->last);
+         mig->cold.segments--;
+         mig->cold.keys  -= b->count;
+         mig->cold.bytes -= b->bytes;
+         mig->cold.splits++;
+         rc_retire_staged(obj->limbo, b, block_free, 0, MIG_GRACE_PERIODS);
+         b = next;
+      }
+   }
+
+   if(cold_rounds == 0 || mig->slice_lo >= mig->slice_hi) return;
+   long now = now_ms();
+   if(now - mig->cold_round < COLD_ROUND_MS) return;
+   mig->cold_round = now;
+
+   for(sl_key_t bkt = mig->slice_lo / bucket_width; bkt <= (mig->slice_hi - 1) / bucket_width; ++bkt) {
+      unsigned sum = 0;
+      for(int e = 0; e < mig_num_states(); ++e) {
+         sum += mig_states[e]->cold_updates[bkt];
+      }
+      if(sum != mig->cold_seen[bkt]) {
+         mig->cold_seen[bkt]  = sum;
+         mig->cold_quiet[bkt] = 0;
+         continue;
+      }
+      if(mig->cold_quiet[bkt] < cold_rounds) mig->cold_quiet[bkt]++;
+      if(mig->cold_quiet[bkt] != cold_rounds) continue;
+
+      // the bucket just turned cold: absorb its runs (retried next round if interrupted)
+      sl_key_t from = bkt * bucket_width;
+      sl_key_t hi   = from + bucket_width;
+      if(from < mig->slice_lo) from = mig->slice_lo;
+      if(hi > mig->slice_hi)   hi   = mig->slice_hi;
+      bool done = true;
+      while(from < hi) {
+         node_t* first = find_run(obj, &from, hi);
+         if(NULL == first) break;
+         sl_key_t last = absorb(obj, first, hi);
+         if(last == 0) {
+            done = false;
+            break;
+         }
+         from = last + 1;
+      }
+      if(done) mig->cold_quiet[bkt] = cold_rounds + 1;
+   }
+}
@@ -0,0 +1,56 @@
+/*
+ * Interface for the immutable compressed cold segments of the data layer
+ *
+ * Author: Henry Daly, 2018
+ */
+#ifndef COLD_H_
+#define COLD_H_
+
+#include "common.h"
+#include "skiplist.h"
+
+#define COLD_SEG_KEYS   256    // keys absorbed by a segment
+#define COLD_MIN_KEYS   16     // shorter runs of ordinary nodes are left alone
+#define COLD_RESTART    16     // entries between two restart points of a block
+#define COLD_BUCKETS    1024   // update counters per enclave (the key range is split evenly)
+#define COLD_ROUND_MS   100    // length of a maintenance round
+
+class enclave;
+
+/**
+ * cold_block is the immutable, delta-encoded content of a cold segment. It is followed
+ * by the restart keys, the restart offsets and the entries: each entry is the varint
+ * key delta from the previous entry followed by the zigzag varint of (value - key).
+ * Logically deleted keys are kept with a NULL value, so that splitting the segment
+ * restores every node it absorbed.
+ */
+struct cold_block {
+   cold_block*    link;          // split blocks handed to the helper thread
+   node_t*        node;          // the segment node
+   volatile AO_t  splitting;     // set by the thread which splits the segment
+   sl_key_t       last;          // last key of the segment (the first is the node's key)
+   int            owner;         // enclave whose helper built the segment and retires it
+   int            count;         // entries
+   int            live;          // entries with a value
+   int            num_restarts;
+   int            bytes;         // size of the whole block
+};
+
+/* cold_stats are the cold segment counters of an enclave (of the segments its helper
+   built: a split segment is handed back to that helper) */
+struct cold_stats {
+   long           segments;
+   long           keys;
+   long           bytes;
+   unsigned long  splits;
+};
+
+void        cold_init(long range, int rounds);
+bool        cold_find(cold_block* b, sl_key_t key, val_t* val);
+int         cold_scan(cold_block* b, sl_key_t from, int len);
+int         cold_live(cold_block* b, sl_key_t* keys, val_t* vals);
+void        cold_split(node_t* seg, cold_block* b);
+void        cold_update(enclave* obj, sl_key_t key);
+void        cold_maintain(enclave* obj);
+
+#endif /* COLD_H_ */
@@ -10,6 +10,11 @@
 
 #define VOLATILE /* volatile */
 #define BARRIER() asm volatile("" ::: "memory");
+#if defined(__x86_64__) || defined(__i386__)
+#define PAUSE() asm volatile("pause" ::: "memory");
+#else
+#define PAUSE() BARRIER()
+#endif
 
 #define CAS(_m, _o, _n) \
     AO_compare_and_swap_full(((volatile AO_t*) _m), ((AO_t) _o), ((AO_t) _n))
@@ -54,17 +59,26 @@ inline long rand_range(long r) {
 }
 inline long rand_range(long r);
 
-/* Thread-safe, re-entrant version of rand_range(r) */
+/* Thread-safe, re-entrant version of rand_range(r) (ranges beyond RAND_MAX draw 64 bits,
+   redrawn while they fall in the 2^64 mod r values which would bias the low keys) */
 inline long rand_range_re(unsigned int *seed, long r) {
-   int m = RAND_MAX;
-   int d, v = 0;
-   do {
-      d = (m > r ? r : m);
-      v += 1 + (int)(d * ((double)rand_r(seed)/((double)(m)+1.0)));
-      r -= m;
-   } while (r > 0);
-   return v;
+   if (r > RAND_MAX) {
+      unsigned long x, skew = (0UL - (unsigned long)r) % (unsigned long)r;
+      do {
+         x  = (unsigned long)rand_r(seed) << 62;
+         x ^= (unsigned long)rand_r(seed) << 31;
+         x ^= (unsigned long)rand_r(seed);
+      } while (x < skew);
+      return 1 + (long)(x % (unsigned long)r);
+   }
+   return 1 + (long)(r * ((double)rand_r(seed)/((double)(RAND_MAX)+1.0)));
 }
 long rand_range_re(unsigned int *seed, long r);
 
+/* range_slice() - first key of slice @i of [1, @range] split evenly in @n slices
+   (1 + i * range / n, without overflowing for ranges near 2^63) */
+inline long range_slice(long range, int n, int i) {
+   return 1 + i * (range / n) + i * (range % n) / n;
+}
+
 #endif /* COMMON_H_ */
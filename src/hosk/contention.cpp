@@ -0,0 +1,160 @@
+/*
+ * contention.cpp: contention manager of data layer updates
+ *
+ * Author: Henry Daly, 2018
+ */
+
+/**
+ * Module Overview:
+ *
+ * An update whose CAS on the data layer fails (an insert losing the race to link its
+ * node, a delete losing the race on the value) is retried by sl_traverse_data(). The
+ * contention manager decides what happens in between: nothing, an exponential backoff
+ * (a random number of spins below a bound which doubles with every retry) or a
+ * proportional backoff (a fixed number of spins per retry). Both are capped at
+ * CM_MAX_SPINS.
+ *
+ * By default the retry resumes at the node where the update failed, which is the
+ * predecessor of the search key; the re-walk option instead restarts it from the entry
+ * node given by the index layer. Each application thread counts its retries and
+ * backoff spins.
+ *
+ * With elimination, an insert and a delete of the same key which are pending at the same
+ * time cancel out in an exchanger slot (keys are hashed to CM_ELIM_SLOTS slots) instead of
+ * both updating the data layer: they linearize back to back (insert then delete if the key
+ * was absent, delete then insert otherwise), both succeed and the set is unchanged. Every
+ * update first looks for the opposite offer on its key's slot. Only on a slot which saw
+ * failed CASes (its heat) does an update post an offer and wait up to CM_ELIM_SPINS for a
+ * partner; an offer left unmatched cools the slot down.
+ *
+ * NOTE: a cancelled insert does not write its value, so this relies on the values being
+ * a function of the key (as in the benchmark)
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "contention.h"
+
+#define ELIM_OFFER   1
+#define ELIM_TAKEN   2
+
+/* cm_slot is an elimination exchanger slot: 0, or an offer (key, update type, state) */
+struct cm_slot {
+   volatile AO_t  word;
+   volatile AO_t  heat;     // recent failed CASes of the slot's keys (racy counter)
+   char           pad[CACHE_LINE_SIZE - 2 * sizeof(AO_t)];
+};
+
+static int      cm_policy = CM_NONE;
+static bool     cm_restart_entry = false;
+static cm_slot* cm_slots = NULL;
+
+/* cm_set_policy() - select the backoff policy, restart point and elimination (before the run) */
+void cm_set_policy(int policy, bool rewalk, bool eliminate) {
+   cm_policy        = policy;
+   cm_restart_entry = rewalk;
+   if(eliminate && NULL == cm_slots) {
+      cm_slots = (cm_slot*)ALIGNED_ALLOC(CM_ELIM_SLOTS * sizeof(cm_slot));
+      memset(cm_slots, 0, CM_ELIM_SLOTS * sizeof(cm_slot));
+   }
+}
+
+/* slot_of() - the exchanger slot of @key */
+static inline cm_slot* slot_of(unsigned long key) {
+   return &cm_slots[(key * 0x9E3779B97F4A7C15UL) >> 54 & (CM_ELIM_SLOTS - 1)];
+}
+
+/* elim_word() - the exchanger word of an update of @key in @state (keys below 2^61) */
+static inline AO_t elim_word(unsigned long key, bool insert, AO_t state) {
+   return ((AO_t)key << 3) | ((AO_t)insert << 2) | state;
+}
+
+/* cm_policy_name() - printable name of a backoff policy */
+const char* cm_policy_name(int policy) {
+   switch(policy) {
+      case CM_EXPONENTIAL:  return "exponential";
+      case CM_PROPORTIONAL: return "proportional";
+      default:              return "none";
+   }
+}
+
+/* cm_rewalk() - true if a retried update restarts from its entry node */
+bool cm_rewalk(void) {
+   return cm_restart_entry;
+}
+
+/**
+ * cm_retry() - count a failed update attempt and back off before the next one
+ * @cm      - the contention counters of the calling thread
+ * @attempt - failed attempts of the update so far (1 on the first failure)
+ * @key     - the key of the update
+ */
+void cm_retry(cm_stats* cm, int attempt, unsigned long key) {
+   long spins = 0;
+   cm->retries++;
+   if(NULL != cm_slots) {
+      cm_slot* s = slot_of(key);
+      if(s->heat < CM_ELIM_HEAT) s->heat++;
+   }
+   if(CM_EXPONENTIAL == cm_policy) {
+      long bound = (attempt < 16) ? (long)CM_BASE_SPINS << (attempt - 1) : CM_MAX_SPINS;
+      if(bound > CM_MAX_SPINS) bound = CM_MAX_SPINS;
+      spins = rand_range_re(&cm->seed, bound);
+   } else if(CM_PROPORTIONAL == cm_policy) {
+      spins = (long)CM_BASE_SPINS * attempt;
+      if(spins > CM_MAX_SPINS) spins = CM_MAX_SPINS;
+   }
+   cm->spins += spins;
+   for(long i = 0; i < spins; ++i) {
+      BARRIER();
+   }
+}
+
+/**
+ * cm_done() - record the retries of a completed update
+ * @cm       - the contention counters of the calling thread
+ * @attempts - failed attempts of the update
+ */
+void cm_done(cm_stats* cm, int attempts) {
+   if(attempts == 0) return;
+   int b = 0;
+   while(b < CM_RETRY_HIST - 1 && (attempts >> (b + 1)) > 0) b++;
+   cm->hist[b]++;
+   cm->contended++;
+   if((unsigned long)attempts > cm->max_retries) cm->max_retries = attempts;
+}
+
+/**
+ * cm_eliminate() - try to cancel an update out with the opposite update of the same key
+ * @cm     - the contention counters of the calling thread
+ * @key    - the key of the update
+ * @insert - true for an insert, false for a delete
+ * returns true if the update was eliminated (it succeeded without touching the data layer)
+ */
+bool cm_eliminate(cm_stats* cm, unsigned long key, bool insert) {
+   if(NULL == cm_slots) return false;
+   cm_slot* s = slot_of(key);
+   AO_t w = s->word;
+   AO_t partner = elim_word(key, !insert, ELIM_OFFER);
+   if(w == partner && CAS(&s->word, partner, elim_word(key, !insert, ELIM_TAKEN))) {
+      cm->eliminated++;
+      return true;
+   }
+   if(0 != w || 0 == s->heat) return false;
+
+   AO_t offer = elim_word(key, insert, ELIM_OFFER);
+   if(!CAS(&s->word, 0, offer)) return false;
+   cm->offers++;
+   for(int i = 0; i < CM_ELIM_SPINS && s->word == offer; ++i) {
+      BARRIER();
+   }
+   if(CAS(&s->word, offer, 0)) {
+      // withdrawn: the slot cools down
+      if(s->heat > 0) s->heat--;
+      return false;
+   }
+   // taken: only the offering thread frees the slot
+   AO_store_full(&s->word, 0);
+   cm->eliminated++;
+   return true;
+}
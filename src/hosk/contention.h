@@ -0,0 +1,44 @@
+/*
+ * Interface for the contention manager of data layer updates
+ *
+ * Author: Henry Daly, 2018
+ */
+#ifndef CONTENTION_H_
+#define CONTENTION_H_
+
+#include "common.h"
+
+#define CM_BASE_SPINS   32     // spins of the first backoff (and of each retry, proportional)
+#define CM_MAX_SPINS    8192   // longest backoff
+#define CM_RETRY_HIST   8      // retry histogram buckets: 1, 2-3, 4-7, ... retries per operation
+#define CM_ELIM_SLOTS   1024   // elimination exchanger slots (keys are hashed)
+#define CM_ELIM_SPINS   512    // spins an offer waits for the opposite update
+#define CM_ELIM_HEAT    64     // most contention remembered by an exchanger slot
+
+/* backoff policies after a failed data layer CAS */
+enum cm_policy {
+   CM_NONE,          // retry at once
+   CM_EXPONENTIAL,   // random backoff, its bound doubling with every retry
+   CM_PROPORTIONAL   // backoff growing linearly with the retries
+};
+
+/* cm_stats are the contention counters of an application thread */
+struct cm_stats {
+   unsigned long  retries;                   // failed update attempts
+   unsigned long  contended;                 // updates which were retried
+   unsigned long  spins;                     // backoff spins
+   unsigned long  max_retries;               // most retries of a single update
+   unsigned long  hist[CM_RETRY_HIST];       // updates by number of retries (log2 buckets)
+   unsigned long  offers;                    // updates which waited in an exchanger slot
+   unsigned long  eliminated;                // updates cancelled out by the opposite update
+   unsigned int   seed;                      // backoff randomization
+};
+
+void        cm_set_policy(int policy, bool rewalk, bool eliminate);
+const char* cm_policy_name(int policy);
+bool        cm_rewalk(void);
+void        cm_retry(cm_stats* cm, int attempt, unsigned long key);
+void        cm_done(cm_stats* cm, int attempts);
+bool        cm_eliminate(cm_stats* cm, unsigned long key, bool insert);
+
+#endif /* CONTENTION_H_ */
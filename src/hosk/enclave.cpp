@@ -9,9 +9,25 @@
  *
  * The enclave class provides an abstraction for an application
  * and helper thread running on the same core.
+ *
+ * Both threads persist from the enclave's construction to its destruction. The thread
+ * which constructs the enclave becomes its application thread: it waits for a phase to
+ * be posted (population, then the run), runs it and reports back by returning to
+ * EN_IDLE. The helper thread is started once, before population. When population is
+ * done, it rebuilds the index layer in place (reset_index_layer()) and signals the main
+ * thread when the index reaches the target height (wait_index()). A bulk load instead
+ * runs its steps as phases of the application threads (see bulk_load.cpp), before the
+ * helper thread is started.
  */
 
+#include <linux/futex.h>
 #include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
 #include "enclave.h"
 #include "hardware_layout.h"
 #include "skiplist.h"
@@ -28,9 +44,37 @@ enclave::enclave(core_t* c, int sock, inode_t* s, int freq, int e_num, int bsz)
    }
    aparams = NULL;
    iparams = NULL;
+   bulk = NULL;
    app_idx = hlp_idx = tall_del = non_del = 0;
-   finished = running = reset_index = populate_init = false;
-   hlpth = appth = num_populate = 0;
+   finished = running = reset_index = populate_init = learned = migrate = deferred = pooled = false;
+   pass_lock = 0;
+   idling = sched_idle = false;
+   sleeping = 0;
+   sleeps = wakeups = lends = 0;
+   lend_depth = 0;
+   lend_params = NULL;
+   lent = NULL;
+   lending = false;
+   hlpth = appth = num_populate = model_changes = inline_ops = 0;
+   pthread_mutex_init(&sync_lock, NULL);
+   pthread_cond_init(&sync_cond, NULL);
+   phase = EN_IDLE;
+   results = NULL;
+   index_target = index_level = index_stall = 0;
+   index_ready = false;
+   model = NULL;
+   chunks = NULL;
+   mig = NULL;
+   frozen = NULL;
+   pending = NULL;
+   size = sz_new();
+   memset(&cm, 0, sizeof(cm_stats));
+   memset(&vn, 0, sizeof(vn_stats));
+   cm.seed = update_seed;
+   app_rc = rc_register();
+   hlp_rc = rc_register();
+   lend_rc = rc_register();
+   limbo = rc_limbo_new();
 #ifdef COUNT_TRAVERSAL
    trav_idx = trav_dat = total_ops = 0;
 #endif
@@ -56,40 +100,176 @@ enclave::~enclave() {
       stop_helper();
       stop_application();
    }
+   post_phase(EN_EXIT);
+   pthread_join(appth, NULL);
+   pthread_mutex_destroy(&sync_lock);
+   pthread_cond_destroy(&sync_cond);
+   rc_limbo_free(limbo);
+   if(model) model_free(model, 0);
+   if(chunks) mchunk_dir_free(chunks);
+   if(mig) mig_free(mig);
+   if(pending) free(pending);
+   if(lent) delete lent;
+   sz_free(size);
+   rc_unregister(app_rc);
+   rc_unregister(hlp_rc);
+   rc_unregister(lend_rc);
+}
+
+/* pass_acquire()/pass_release() - exclude the helper pool from the enclave */
+static void pass_acquire(volatile AO_t* lock) {
+   // claim the lock first so that the pool cannot start further passes, then wait for the current one
+   AO_t old;
+   do {
+      old = *lock;
+   } while(!CAS(lock, old, old | 2));
+   while(2 != *lock) sched_yield();
+}
+static void pass_release(volatile AO_t* lock) {
+   AO_store_release(lock, 0);
 }
 
-/* start_helper() - starts helper thread */
+/**
+ * start_helper() - starts helper thread
+ *  (inline mode: prepares the application thread's passes; pooled: lets the helper pool serve the enclave)
+ */
 void enclave::start_helper(bool pop_all) {
    if(!running) {
+      if(pooled) pass_acquire(&pass_lock);
       populate_init = pop_all;
       running = true;
       finished = false;
+      if(inline_ops > 0 || pooled) {
+         helper_start(this);
+         if(pooled) pass_release(&pass_lock);
+         return;
+      }
       pthread_create(&hlpth, NULL, helper_loop, (void*)this);
    }
 }
 
-/* stop_helper() - stops helper thread */
+/**
+ * stop_helper() - stops helper thread
+ *  (inline mode: drains the opbuffer; pooled: waits for the pass in progress)
+ */
 void enclave::stop_helper(void) {
    if(running) {
+      if(pooled) pass_acquire(&pass_lock);
       finished = true;
-      pthread_join(hlpth, NULL);
+      if(inline_ops > 0) {
+         op_t job;
+         helper_pass(this, &job, populate_init);
+      } else if(!pooled) {
+         // the helper sets sleeping before its last look at finished
+         AO_nop_full();
+         helper_wake();
+         pthread_join(hlpth, NULL);
+      }
       running = false;
+      if(pooled) pass_release(&pass_lock);
    }
 }
 
-/* start_application() - starts application thread */
+/**
+ * serve() - run the phases posted to the application thread until the enclave is destroyed
+ *  (called by the thread which constructed the enclave, pinned to its hardware thread)
+ * @ready - crossed once the enclave can take phases
+ */
+void enclave::serve(barrier_t* ready) {
+   appth = pthread_self();
+   barrier_cross(ready);
+   while(1) {
+      pthread_mutex_lock(&sync_lock);
+      while(EN_IDLE == phase) pthread_cond_wait(&sync_cond, &sync_lock);
+      int p = phase;
+      pthread_mutex_unlock(&sync_lock);
+      if(EN_EXIT == p) break;
+      if(EN_POPULATE == p)  initial_populate(this);
+      else if(EN_BULK == p) bl_run(this);
+      else                  results = application_loop(this);
+      pthread_mutex_lock(&sync_lock);
+      phase = EN_IDLE;
+      pthread_cond_broadcast(&sync_cond);
+      pthread_mutex_unlock(&sync_lock);
+   }
+}
+
+/* post_phase() - hand a phase to the application thread */
+void enclave::post_phase(int p) {
+   pthread_mutex_lock(&sync_lock);
+   phase = p;
+   pthread_cond_broadcast(&sync_cond);
+   pthread_mutex_unlock(&sync_lock);
+}
+
+/* wait_idle() - wait until the application thread finished its phase */
+void enclave::wait_idle(void) {
+   pthread_mutex_lock(&sync_lock);
+   while(EN_IDLE != phase) pthread_cond_wait(&sync_cond, &sync_lock);
+   pthread_mutex_unlock(&sync_lock);
+}
+
+/* start_application() - starts the application thread's run */
 void enclave::start_application(app_param* init) {
    aparams = init;
-   pthread_create(&appth, NULL, application_loop, (void*)this);
+   post_phase(EN_RUN);
 }
 
-/* stop_application() - stops application thread*/
+/* stop_application() - waits for the application thread's run to stop and returns its results */
 app_res* enclave::stop_application(void) {
-   app_res* results = NULL;
-   pthread_join(appth, (void**)&results);
+   wait_idle();
    return results;
 }
 
+/**
+ * index_check() - signal the index height handshake once the index reached its target
+ *  height, or once IDX_STALL_PASSES index layer updates left its height unchanged
+ *  (called after every index layer update; the population updates stop with it)
+ *
+ * A reset requested before the wait is not signalled: a pass which missed the request
+ *  still sees the population-time index, which is rebuilt by the next pass.
+ */
+void enclave::index_check(void) {
+   if(0 == index_target || index_ready) return;
+   int level = sentinel->intermed->level;
+   if(level != index_level) {
+      index_level = level;
+      index_stall = 0;
+   } else {
+      index_stall++;
+   }
+   if(level >= index_target || index_stall >= IDX_STALL_PASSES) {
+      pthread_mutex_lock(&sync_lock);
+      if(!reset_index) {
+         populate_init = false;
+         index_ready = true;
+         pthread_cond_broadcast(&sync_cond);
+      }
+      pthread_mutex_unlock(&sync_lock);
+   }
+}
+
+/**
+ * wait_index() - wait until the index layer is @level high (or stops growing)
+ *  (inline mode: raises the index layer on the calling thread)
+ */
+void enclave::wait_index(int level) {
+   pthread_mutex_lock(&sync_lock);
+   index_ready = false;
+   index_stall = 0;
+   index_level = sentinel->intermed->level;
+   index_target = (level > 0) ? level : 1;
+   pthread_mutex_unlock(&sync_lock);
+   if(inline_ops > 0) {
+      op_t job;
+      while(!index_ready) helper_pass(this, &job, true);
+   }
+   pthread_mutex_lock(&sync_lock);
+   while(!index_ready) pthread_cond_wait(&sync_cond, &sync_lock);
+   index_target = 0;
+   pthread_mutex_unlock(&sync_lock);
+}
+
 /* get_sentinel() - return sentinel index node of search layer */
 inode_t* enclave::get_sentinel(void) {
    return sentinel;
@@ -119,19 +299,30 @@ int enclave::get_socket_num(void) {
 }
 
 /* populate_begin() - populates num elements from local enclave */
-void enclave::populate_begin(init_param* params, int num_to_pop) {
+void enclave::populate_begin(init_param* params, long num_to_pop) {
    iparams = params;
    num_populate = num_to_pop;
-   pthread_create(&appth, NULL, initial_populate, (void*)this);
+   post_phase(EN_POPULATE);
 }
 
 /* populate_end() - finishes population */
-uint enclave::populate_end(void) {
-   pthread_join(appth, NULL);
+sl_key_t enclave::populate_end(void) {
+   wait_idle();
    return *(iparams->last);
 }
 
-/* reset_index() - resets index layers */
+/* bulk_begin() - runs the current step of @job on the application thread */
+void enclave::bulk_begin(bl_job* job) {
+   bulk = job;
+   post_phase(EN_BULK);
+}
+
+/* bulk_end() - waits for the application thread to finish the step */
+void enclave::bulk_end(void) {
+   wait_idle();
+}
+
+/* reset_index() - resets index layers (on the next maintenance pass) */
 void enclave::reset_index_layer(void) {
    reset_index = true;
 }
@@ -158,7 +349,13 @@ bool enclave::opbuffer_insert(sl_key_t key, node_t* node) {
    // Regular opbuffer insert
    opbuffer[app_idx].key   = key;
    opbuffer[app_idx].node  = node;
+   BARRIER();
    app_idx = (app_idx + 1) % buf_size;
+   if(idling) {
+      // the helper sets sleeping before its last look at app_idx
+      AO_nop_full();
+      if(0 != sleeping) helper_wake();
+   }
    return true;
 }
 
@@ -169,8 +366,10 @@ bool enclave::opbuffer_insert(sl_key_t key, node_t* node) {
  * @passed - the element which will hold the copied array values
  */
 op_t* enclave::opbuffer_remove(op_t** passed) {
-   // Leave one element untouched in case app thread decides to undo last operation
-   if(app_idx - ((hlp_idx + 1) % buf_size) <= 1) return NULL;
+   // Drain every published element: a relocated node is freed once the helpers have
+   //    had a grace period to consume the publications which reference it
+   if(hlp_idx == app_idx) return NULL;
+   BARRIER();
 
    // Regular opbuffer remove
    (*passed)->key  = opbuffer[hlp_idx].key;
@@ -179,6 +378,111 @@ op_t* enclave::opbuffer_remove(op_t** passed) {
    return (*passed);
 }
 
+/**
+ * opbuffer_usage() - bytes of the operation array
+ * @capacity - set to the size of the array
+ * @pending  - set to the bytes of the operations not yet consumed by the helper thread
+ */
+void enclave::opbuffer_usage(unsigned long* capacity, unsigned long* pending) {
+   *capacity = (unsigned long)buf_size * sizeof(op_t);
+   *pending  = (unsigned long)opbuffer_pending() * sizeof(op_t);
+}
+
+/**
+ * helper_sleep() - put the helper thread to sleep until an operation is published,
+ *  the helper is stopped or HLP_SLEEP_MS elapse
+ */
+void enclave::helper_sleep(void) {
+   struct timespec timeout = {0, HLP_SLEEP_MS * 1000000L};
+   sleeping = 1;
+   AO_nop_full();
+   if(app_idx == hlp_idx && !finished) {
+      sleeps++;
+      syscall(SYS_futex, &sleeping, FUTEX_WAIT_PRIVATE, 1, &timeout, NULL, 0);
+   }
+   sleeping = 0;
+}
+
+/* helper_wake() - wake the helper thread up if it sleeps */
+void enclave::helper_wake(void) {
+   if(0 != sleeping) {
+      sleeping = 0;
+      wakeups++;
+      syscall(SYS_futex, &sleeping, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+   }
+}
+
+/* opbuffer_pending() - number of operations not yet consumed by the helper thread */
+int enclave::opbuffer_pending(void) {
+   int app = app_idx, hlp = hlp_idx;
+   return (app - hlp + buf_size) % buf_size;
+}
+
+/* pt_consumed() - true once the helper thread has consumed the opbuffer slot @slot */
+static inline bool pt_consumed(int slot, int app, int hlp, int size) {
+   return (slot - hlp + size) % size >= (app - hlp + size) % size;
+}
+
+/**
+ * pt_add() - remember a fresh insert of the application thread (just published)
+ * @key  - the inserted key
+ * @node - its data layer node
+ *
+ * NOTE: a node is only freed once the helper has drained the publications made before it
+ *  was retired (see opbuffer_remove()), so the nodes of unconsumed slots are safe to enter
+ */
+void enclave::pt_add(sl_key_t key, node_t* node) {
+   pt_table* t = pending;
+   int app = app_idx, hlp = hlp_idx;
+   int slot = (app + buf_size - 1) % buf_size;
+   int n = 0, oldest = -1;
+
+   // trim the inserts the helper thread caught up with
+   for(int i = 0; i < t->count; ++i) {
+      pt_entry* e = &t->entries[i];
+      if(e->key == key || pt_consumed(e->slot, app, hlp, buf_size)) continue;
+      t->entries[n++] = *e;
+   }
+   t->count = n;
+   if(n == PT_SIZE) {
+      for(int i = 0; i < n; ++i) {
+         if(oldest < 0 || (t->entries[i].slot - hlp + buf_size) % buf_size <
+                          (t->entries[oldest].slot - hlp + buf_size) % buf_size) oldest = i;
+      }
+      for(int i = oldest; i < n - 1; ++i) t->entries[i] = t->entries[i + 1];
+      t->count = --n;
+   }
+
+   // keep the table sorted by key
+   int pos = n;
+   while(pos > 0 && t->entries[pos - 1].key > key) {
+      t->entries[pos] = t->entries[pos - 1];
+      pos--;
+   }
+   t->entries[pos].key  = key;
+   t->entries[pos].node = node;
+   t->entries[pos].slot = slot;
+   t->count++;
+}
+
+/**
+ * pt_lookup() - the node of the largest fresh insert <= @key, NULL if none is pending
+ * @key - the search key
+ */
+node_t* enclave::pt_lookup(sl_key_t key) {
+   pt_table* t = pending;
+   int lo = 0, hi = t->count;
+   while(lo < hi) {
+      int mid = (lo + hi) / 2;
+      if(t->entries[mid].key <= key) lo = mid + 1;
+      else                            hi = mid;
+   }
+   if(lo == 0) return NULL;
+   pt_entry* e = &t->entries[lo - 1];
+   if(pt_consumed(e->slot, app_idx, hlp_idx, buf_size)) return NULL;
+   return e->node;
+}
+
 #ifdef BG_STATS
 /* bg_stats() - print background statistics */
 void enclave::bg_stats(void) {
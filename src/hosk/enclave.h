@@ -6,9 +6,24 @@
 #ifndef ENCLAVE_H_
 #define ENCLAVE_H_
 #include "skiplist.h"
+#include "bulk_load.h"
+#include "contention.h"
+#include "frozen.h"
 #include "hardware_layout.h"
+#include "learned_index.h"
+#include "mchunk.h"
+#include "migrate.h"
+#include "reclaim.h"
+#include "set_size.h"
+#include "virtual_numa.h"
 #define APP_IDX   0
 #define HLP_IDX   1
+#define HLP_SPIN_PASSES 64    // empty passes an idling helper thread spins through before sleeping
+#define HLP_SPIN_PAUSES 32    // pause instructions between two spinning passes
+#define HLP_SLEEP_MS    10    // longest sleep of an idling helper thread (periodic maintenance runs on wakeup)
+#define IDX_STALL_PASSES 8    // index layer updates without a new level before the index stops growing
+#define LEND_BATCH      64    // reads of a lent helper thread between two checks for maintenance work
+#define LEND_SLICE_MS   5     // longest time a helper thread is lent to readers (bounds index layer staleness)
 // Uncomment to collect stats on thread-local index and data layer traversal
 //#define COUNT_TRAVERSAL
 
@@ -24,6 +39,15 @@ struct bg_stats {
 };
 #endif
 
+/* phases of the persistent application thread */
+enum en_phase {
+   EN_IDLE,          // waiting for the next phase (the last one finished)
+   EN_POPULATE,      // initial population
+   EN_BULK,          // a step of a bulk load
+   EN_RUN,           // the benchmark run
+   EN_EXIT           // the enclave is destroyed
+};
+
 /* op_t is the element which the enclave's circular array will contain.
    a node value of NULL implies the operation was a remove */
 struct op_t {
@@ -34,11 +58,13 @@ struct op_t {
 
 /* app_param defines the information passed to an application thread */
 struct app_param {
-   unsigned int   first;
+   sl_key_t       first;
    long           range;
    int            update;
    int            alternate;
    int            effective;
+   int            hotspot;
+   int            scan;
    unsigned int   seed;
    barrier_t*     barrier;
    VOLATILE AO_t* stop;
@@ -47,12 +73,32 @@ struct app_param {
 /* init_param defines the information passed to a enclave thread during
    initial population */
 struct init_param {
-   int   num;
-   long  range;
-   uint  seed;
-   uint* last;
+   long      num;
+   long      range;
+   uint      seed;
+   sl_key_t* last;
+};
+
+#define PT_SIZE      16     // fresh inserts remembered until the helper thread indexes them
+
+/* pt_entry is a fresh insert of the application thread and its opbuffer slot */
+struct pt_entry {
+   sl_key_t    key;
+   node_t*     node;
+   int         slot;
 };
 
+/* pt_table holds the application thread's inserts not yet consumed by the helper, by key */
+struct pt_table {
+   int            count;
+   unsigned long  hits;       // operations which entered the data layer through the table
+   pt_entry       entries[PT_SIZE];
+};
+
+#define LAT_SAMPLE   64     // operations between two timed operations
+#define LAT_BUCKETS  1024   // latency histogram buckets (the last one holds the overflow)
+#define LAT_NS       32     // nanoseconds per latency histogram bucket
+
 /* app_res defines the information returned to the main thread at the end
    of an application thread's execution */
 struct app_res {
@@ -62,6 +108,11 @@ struct app_res {
    unsigned long removed;
    unsigned long contains;
    unsigned long found;
+   unsigned long scans;
+   unsigned long scanned;
+   unsigned long scan_hops;
+   unsigned long lat[LAT_BUCKETS];   // sampled contains latencies
+   unsigned long ulat[LAT_BUCKETS];  // sampled update latencies
 };
 
 class enclave {
@@ -74,28 +125,69 @@ private:
    core_t*     core;          // holds the hardware thread ids of the app and helper thread
    int         socket_num;    // Socket id on which enclave executes
    int         buf_size;      // size of the circular op array
-   int         app_idx;       // index of application thread in circular array
-   int         hlp_idx;       // index of helper thread in circular array
+   volatile int app_idx;     // index of application thread in circular array
+   volatile int hlp_idx;     // index of helper thread in circular array
    bool        running;       // represents if helper thread is running
 
 public:
    app_param*  aparams;       // parameters for the application thread execution
    init_param* iparams;       // parameters for population
-   int         non_del;       // # non deleted intermediate nodes
-   int         tall_del;      // # deleted intermediate nodes w/ towers above
+   bl_job*     bulk;          // bulk load whose current step the application thread runs
+   long        non_del;       // # non deleted intermediate nodes
+   long        tall_del;      // # deleted intermediate nodes w/ towers above
    uint        update_seed;   // seed for helper thread random generator
    int         update_freq;   // frequency of index layer updates
-   int         num_populate;  // number of elements inserted during initial population
+   long        num_populate;  // number of elements inserted during initial population
    bool        finished;      // represents if helper thread is finished
-   bool        reset_index;   // represents when population has completed and index layer should reset
+   volatile bool reset_index; // represents when population has completed and index layer should reset
    bool        populate_init; // represents if the helper thread should populate the index layer every time
+   bool        learned;       // represents if the learned index mode is enabled
+   sl_model* volatile model;  // published learned model (NULL until first built)
+   long        model_changes; // intermediate layer insertions since the last model build
+   mchunk_dir* chunks;        // chunked intermediate layer directory (NULL if not chunked)
+   rc_record*  app_rc;        // reclamation record of the application thread
+   rc_record*  hlp_rc;        // reclamation record of the helper thread
+   rc_limbo*   limbo;         // objects retired by the helper thread
+   bool        migrate;       // represents if application threads sample remote accesses
+   mig_state*  mig;           // hot node migration state (NULL if migration is disabled)
+   fz_replica* frozen;        // read-only replica serving this enclave (NULL unless frozen)
+   bool        deferred;      // represents if the helper thread unlinks the deleted data layer nodes
+   cm_stats    cm;            // contention counters of the application thread
+   pt_table*   pending;       // inserts not yet in the intermediate layer (NULL if disabled)
+   sz_counter* size;          // set size and intermediate layer key counters
+   int         inline_ops;    // operations between two inline maintenance passes (0 = helper thread)
+   bool        pooled;        // maintained by the helper pool instead of a helper thread
+   volatile AO_t pass_lock;   // 1: a helper pool thread runs a pass, 2: the helper is being started or stopped
+   bool        idling;        // represents if the helper thread sleeps while it has no work
+   bool        sched_idle;    // represents if the helper thread runs under SCHED_IDLE
+   volatile int sleeping;     // the helper thread is asleep (or about to be) on this futex word
+   unsigned long sleeps;      // times the helper thread went to sleep
+   unsigned long wakeups;     // sleeps cut short by the application thread
+   int         lend_depth;    // pending operations which call a lent helper thread back (0 = never lent)
+   app_param* volatile lend_params; // parameters of the running application thread (NULL until it runs)
+   app_res*    lent;          // results of the reads run on the lent helper thread
+   rc_record*  lend_rc;       // reclamation record of the reads run on the lent helper thread
+   volatile bool lending;     // represents if the helper thread runs reads
+   unsigned long lends;       // times the helper thread was lent to readers
+   vn_stats    vn;            // data layer node accesses by zone (counted if vn_charging)
+   pthread_mutex_t sync_lock; // guards the phase and index height handshakes
+   pthread_cond_t  sync_cond;
+   int         phase;         // phase posted to the application thread (EN_IDLE once it finished)
+   app_res*    results;       // results of the application thread's last run
+   int         index_target;  // index height the helper signals once reached (0 = none)
+   int         index_level;   // index height at the last index layer update
+   int         index_stall;   // index layer updates which left the height unchanged
+   bool        index_ready;   // represents if the index reached its target height (or stopped growing)
 
                enclave(core_t* c, int sock, inode_t* sent, int freq, int e_num, int bsz);
               ~enclave();
    void        start_helper(bool pop_all);
    void        stop_helper(void);
+   void        serve(barrier_t* ready);
    void        start_application(app_param* init);
    app_res*    stop_application(void);
+   void        index_check(void);
+   void        wait_index(int level);
    inode_t*    get_sentinel(void);
    inode_t*    set_sentinel(inode_t* new_sent);
    int         get_thread_id(int idx);
@@ -103,9 +195,21 @@ public:
    int         get_enclave_num(void);
    bool        opbuffer_insert(sl_key_t key, node_t* node);
    op_t*       opbuffer_remove(op_t** passed);
-   void        populate_begin(init_param* params, int num);
-   uint        populate_end(void);
+   void        opbuffer_usage(unsigned long* capacity, unsigned long* pending);
+   int         opbuffer_pending(void);
+   void        helper_sleep(void);
+   void        helper_wake(void);
+   void        pt_add(sl_key_t key, node_t* node);
+   node_t*     pt_lookup(sl_key_t key);
+   void        populate_begin(init_param* params, long num);
+   sl_key_t    populate_end(void);
+   void        bulk_begin(bl_job* job);
+   void        bulk_end(void);
    void        reset_index_layer(void);
+private:
+   void        post_phase(int p);
+   void        wait_idle(void);
+public:
 
 
 #ifdef COUNT_TRAVERSAL
@@ -128,10 +232,18 @@ public:
 };
 
 /* Public interface for application and helper thread functions */
-void* initial_populate(void* args);
-void* application_loop(void* args);
+void  initial_populate(enclave* obj);
+app_res* application_loop(enclave* obj);
 void* helper_loop(void* args);
+bool  lend_reads(enclave* obj, app_param* params, int num);
+void  helper_start(enclave* obj);
+int   helper_pass(enclave* obj, op_t* job, bool update_all);
 void  node_remove(node_t* prev, node_t* node);
+void  dl_unlink(node_t* node);
+node_t*  dl_entry(node_t* node, sl_key_t key);
+node_t*  bg_find_node(enclave* obj, sl_key_t key);
+mnode_t* bg_find_mnode(enclave* obj, sl_key_t key);
+void  bg_share_node(enclave* obj, mnode_t* mnode, node_t* old, node_t* node);
 void  barrier_init(barrier_t *b, int n);
 void  barrier_cross(barrier_t *b);
 #endif
@@ -0,0 +1,176 @@
+/*
+ * frozen.cpp: frozen read-only layout of the skip list
+ *
+ * Author: Henry Daly, 2018
+ */
+
+/**
+ * Module Overview:
+ *
+ * Between bulk update phases, the skip list can be frozen for a read-only serving phase.
+ * Freezing stops every helper thread and copies the live keys of the data layer (cold
+ * segments included) into sorted key and value arrays, replicated on each NUMA zone, with
+ * a flat search index holding the first key of every FZ_BLOCK keys. Each enclave is then
+ * pointed at the replica of its zone: lookups binary search the index (small enough to stay
+ * cached) and scan one block, and range scans walk the key array.
+ *
+ * No update may run while the skip list is frozen, and neither fz_freeze() nor fz_thaw()
+ * may run concurrently with operations: both are called between phases. Thawing points
+ * the enclaves back to the live structure, frees the replicas and restarts the helpers.
+ */
+
+#include <assert.h>
+#include <numa.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cold.h"
+#include "enclave.h"
+#include "frozen.h"
+
+static fz_replica** replicas = NULL;
+static int num_replicas = 0;
+
+/* zone_alloc() - allocate @bytes on NUMA zone @zone */
+static void* zone_alloc(size_t bytes, int zone) {
+   void* mem = numa_alloc_onnode(bytes ? bytes : 1, vn_node(zone));
+   assert(NULL != mem);
+   return mem;
+}
+
+/* replica_new() - allocate an empty replica of @count keys on @zone */
+static fz_replica* replica_new(long count, int zone) {
+   fz_replica* r = (fz_replica*)zone_alloc(sizeof(fz_replica), zone);
+   r->count      = count;
+   r->num_blocks = (count + FZ_BLOCK - 1) / FZ_BLOCK;
+   r->index      = (sl_key_t*)zone_alloc(r->num_blocks * sizeof(sl_key_t), zone);
+   r->keys       = (sl_key_t*)zone_alloc(count * sizeof(sl_key_t), zone);
+   r->vals       = (val_t*)zone_alloc(count * sizeof(val_t), zone);
+   r->zone       = zone;
+   return r;
+}
+
+/* replica_free() - free a replica */
+static void replica_free(fz_replica* r) {
+   numa_free(r->index, r->num_blocks ? r->num_blocks * sizeof(sl_key_t) : 1);
+   numa_free(r->keys, r->count ? r->count * sizeof(sl_key_t) : 1);
+   numa_free(r->vals, r->count ? r->count * sizeof(val_t) : 1);
+   numa_free(r, sizeof(fz_replica));
+}
+
+/* collect() - copy the live keys of the data layer into @r (sized by data_layer_size) */
+static void collect(fz_replica* r, node_t* head) {
+   long n = 0;
+   for(node_t* node = head->next; NULL != node; node = node->next) {
+      val_t val = node->val;
+      if(val == node || val == DL_MOVING) continue;
+      if(node->seg) {
+         n += cold_live((cold_block*)val, r->keys + n, r->vals + n);
+      } else if(NULL != val) {
+         r->keys[n] = node->key;
+         r->vals[n] = val;
+         n++;
+      }
+   }
+   assert(n == r->count);
+   for(long b = 0; b < r->num_blocks; ++b) {
+      r->index[b] = r->keys[b * FZ_BLOCK];
+   }
+}
+
+/**
+ * fz_freeze() - stop the helpers and switch every enclave to a frozen replica
+ * @enclaves     - the enclaves
+ * @num_enclaves - their number
+ * @head         - the data layer sentinel
+ * @zones        - NUMA zones to place a replica on
+ * @count        - the number of keys in the set, if known (else -1: counted by a walk)
+ */
+void fz_freeze(enclave** enclaves, int num_enclaves, node_t* head, int zones, long count) {
+   assert(NULL == replicas);
+   for(int i = 0; i < num_enclaves; ++i) {
+      enclaves[i]->stop_helper();
+   }
+
+   if(count < 0) count = data_layer_size(head, 1);
+   num_replicas = zones;
+   replicas = (fz_replica**)malloc(zones * sizeof(fz_replica*));
+   replicas[0] = replica_new(count, 0);
+   collect(replicas[0], head);
+   for(int z = 1; z < zones; ++z) {
+      replicas[z] = replica_new(count, z);
+      memcpy(replicas[z]->index, replicas[0]->index, replicas[0]->num_blocks * sizeof(sl_key_t));
+      memcpy(replicas[z]->keys, replicas[0]->keys, count * sizeof(sl_key_t));
+      memcpy(replicas[z]->vals, replicas[0]->vals, count * sizeof(val_t));
+   }
+
+   for(int i = 0; i < num_enclaves; ++i) {
+      enclaves[i]->frozen = replicas[enclaves[i]->get_socket_num() % zones];
+   }
+}
+
+/**
+ * fz_thaw() - switch every enclave back to the live structure and restart the helpers
+ * @enclaves     - the enclaves
+ * @num_enclaves - their number
+ */
+void fz_thaw(enclave** enclaves, int num_enclaves) {
+   if(NULL == replicas) return;
+   for(int i = 0; i < num_enclaves; ++i) {
+      enclaves[i]->frozen = NULL;
+   }
+   for(int z = 0; z < num_replicas; ++z) {
+      replica_free(replicas[z]);
+   }
+   free(replicas);
+   replicas = NULL;
+   for(int i = 0; i < num_enclaves; ++i) {
+      enclaves[i]->start_helper(false);
+   }
+}
+
+/* lower_bound() - position of the first key >= @key in @r */
+static inline long lower_bound(fz_replica* r, sl_key_t key) {
+   // last block whose first key is <= @key
+   long lo = 0, hi = r->num_blocks - 1;
+   while(lo < hi) {
+      long mid = (lo + hi + 1) / 2;
+      if(r->index[mid] <= key) lo = mid;
+      else                     hi = mid - 1;
+   }
+   long pos = lo * FZ_BLOCK;
+   long end = (pos + FZ_BLOCK < r->count) ? pos + FZ_BLOCK : r->count;
+   while(pos < end && r->keys[pos] < key) pos++;
+   return pos;
+}
+
+/**
+ * fz_contains() - search a frozen replica
+ * @r   - the replica
+ * @key - the search key
+ * @val - set to the value of @key if present
+ * returns 1 if @key is present, 0 otherwise
+ */
+int fz_contains(fz_replica* r, sl_key_t key, val_t* val) {
+   long pos = lower_bound(r, key);
+   if(pos == r->count || r->keys[pos] != key) return 0;
+   *val = r->vals[pos];
+   return 1;
+}
+
+/**
+ * fz_scan() - range scan of a frozen replica
+ * @r    - the replica
+ * @key  - the first key of the scan
+ * @len  - the number of keys to visit
+ * @hops - incremented by the number of keys visited
+ * returns the number of keys visited
+ */
+int fz_scan(fz_replica* r, sl_key_t key, int len, unsigned long* hops) {
+   long pos = lower_bound(r, key);
+   int found = 0;
+   for(; pos < r->count && found < len; ++pos) {
+      found += (NULL != r->vals[pos]);
+   }
+   *hops += found;
+   return found;
+}
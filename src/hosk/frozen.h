@@ -0,0 +1,31 @@
+/*
+ * Interface for the frozen read-only layout of the skip list
+ *
+ * Author: Henry Daly, 2018
+ */
+#ifndef FROZEN_H_
+#define FROZEN_H_
+
+#include "common.h"
+#include "skiplist.h"
+
+#define FZ_BLOCK    16     // keys per block of a replica (one search index entry per block)
+
+class enclave;
+
+/* fz_replica is the immutable sorted copy of the live keys, placed on one NUMA zone */
+struct fz_replica {
+   long        count;         // live keys
+   long        num_blocks;
+   sl_key_t*   index;         // first key of every block
+   sl_key_t*   keys;
+   val_t*      vals;
+   int         zone;
+};
+
+void  fz_freeze(enclave** enclaves, int num_enclaves, node_t* head, int zones, long count);
+void  fz_thaw(enclave** enclaves, int num_enclaves);
+int   fz_contains(fz_replica* r, sl_key_t key, val_t* val);
+int   fz_scan(fz_replica* r, sl_key_t key, int len, unsigned long* hops);
+
+#endif /* FROZEN_H_ */
@@ -4,74 +4,149 @@
  *  Author: Henry Daly, 2018
  */
 
+/**
+ * Module Overview:
+ *
+ * The layout is read from sysfs: every hardware thread the process may run on (its
+ * sched_getaffinity() mask, which reflects the cpuset and cgroup limits) reports its
+ * physical package, its core within the package and its NUMA node. Hardware threads
+ * are grouped by package into sockets and by core id into cores, in increasing order,
+ * so no particular CPU numbering is assumed.
+ *
+ * A core lists its hardware threads in increasing order (the SMT siblings of the
+ * application thread's hardware thread come after it). When a core has fewer usable
+ * hardware threads than THREADS_PER_CORE, the first ones repeat: without SMT, a helper
+ * thread shares the hardware thread of its application thread. Without topology
+ * information, every hardware thread is a core of socket 0.
+ *
+ * hl_place() maps the enclaves to cores following a placement policy. Scatter spreads
+ * them round-robin across the sockets, compact fills a socket before the next one, and
+ * distance fills sockets too, picking as the next socket the one closest (in NUMA
+ * distance) to the sockets already in use. A CPU list names the application thread's
+ * hardware thread of each enclave (its helper thread runs on the next sibling of its
+ * core). With more enclaves than cores, enclaves share cores.
+ */
+
+#include <algorithm>
+#include <dirent.h>
+#include <numa.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
 #include "hardware_layout.h"
 
-const char* hyperthread_enabled  = "lscpu | grep ht";
-const char* socket_info          = "lscpu | egrep 'Socket' | awk '{print $NF}'";
-const char* thread_info          = "lscpu | egrep 'Thread' | awk '{print $NF}'";
-const char* core_info            = "lscpu | egrep '^Core' | awk '{print $NF}'";
-const char* num_cpu_info         = "lscpu | egrep '^CPU\\(s\\)' | awk '{print $NF}'";
-
-std::string pipe_to_string(const char* command) {
-    FILE* file = popen( command, "r" ) ;
-    if(file) {
-        std::ostringstream stm;
-        constexpr std::size_t MAX_LINE_SZ = 1024;
-        char line[MAX_LINE_SZ];
-        while(fgets(line, MAX_LINE_SZ, file)){ stm << line << '\n'; }
-        pclose(file) ;
-        return stm.str();
-    }
-    return "";
+/* hl_cpu is a usable hardware thread and its position in the topology */
+struct hl_cpu {
+   int cpu;
+   int package;
+   int core;
+   int node;
+};
+
+/* hl_cpu_less() - order hardware threads by package, core and number */
+static bool hl_cpu_less(const hl_cpu& a, const hl_cpu& b) {
+   if(a.package != b.package) return a.package < b.package;
+   if(a.core != b.core) return a.core < b.core;
+   return a.cpu < b.cpu;
+}
+
+/* read_topology() - read an integer topology attribute of @cpu (@dflt if it is missing) */
+static int read_topology(int cpu, const char* attr, int dflt) {
+   char path[256];
+   snprintf(path, sizeof(path), SYSFS_CPU_DIR "/cpu%d/topology/%s", cpu, attr);
+   FILE* file = fopen(path, "r");
+   if(NULL == file) return dflt;
+   int val = dflt;
+   if(1 != fscanf(file, "%d", &val)) val = dflt;
+   fclose(file);
+   return val;
+}
+
+/* read_node() - the NUMA node of @cpu (its nodeN entry in sysfs, 0 if it has none) */
+static int read_node(int cpu) {
+   char path[256];
+   snprintf(path, sizeof(path), SYSFS_CPU_DIR "/cpu%d", cpu);
+   DIR* dir = opendir(path);
+   if(NULL == dir) return 0;
+   int node = 0;
+   struct dirent* entry;
+   while(NULL != (entry = readdir(dir))) {
+      if(1 == sscanf(entry->d_name, "node%d", &node)) break;
+   }
+   closedir(dir);
+   return node;
 }
 
 hl_t* get_hardware_layout(void) {
    hl_t* machine = (hl_t*)malloc(sizeof(hl_t));
 
-   // Ensure HyperThreading is enabled (i.e. 2 hardware threads per core)
-   std::string ht_enabled = pipe_to_string(hyperthread_enabled);
-   int threads_per_core  = std::stoi(pipe_to_string(thread_info));
-   if(!ht_enabled.compare("") || threads_per_core != THREADS_PER_CORE) {
-      std::cout << "ERROR: HyperThreading not enabled!\n";
+   // Usable hardware threads
+   cpu_set_t allowed;
+   CPU_ZERO(&allowed);
+   if(0 != sched_getaffinity(0, sizeof(cpu_set_t), &allowed)) {
+      perror("sched_getaffinity");
       exit(-1);
    }
+   int num_cpus = CPU_COUNT(&allowed);
+   hl_cpu* cpus = (hl_cpu*)malloc(num_cpus * sizeof(hl_cpu));
+   int n = 0;
+   for(int cpu = 0; cpu < CPU_SETSIZE && n < num_cpus; ++cpu) {
+      if(!CPU_ISSET(cpu, &allowed)) continue;
+      cpus[n].cpu     = cpu;
+      cpus[n].package = read_topology(cpu, "physical_package_id", 0);
+      cpus[n].core    = read_topology(cpu, "core_id", cpu);
+      cpus[n].node    = read_node(cpu);
+      n++;
+   }
+   std::sort(cpus, cpus + n, hl_cpu_less);
 
-   // Get Hardware information and create structure
-   int socket_num       = std::stoi(pipe_to_string(socket_info));
-   int cores_per_socket = std::stoi(pipe_to_string(core_info));
-   machine->max_cpu_num = std::stoi(pipe_to_string(num_cpu_info));
-   int num_hw_cpus = socket_num * cores_per_socket * threads_per_core;
-   if(num_hw_cpus != machine->max_cpu_num) {
-      std::cout << "ERROR: lscpu parse issue - CPU numbers don't match!\n";
-      exit(-1);
+   // Count the sockets, and the cores of each socket
+   int num_sockets = 0;
+   for(int i = 0; i < n; ++i) {
+      if(0 == i || cpus[i].package != cpus[i - 1].package) num_sockets++;
    }
-   machine->num_sockets = socket_num;
-   machine->cores_per_socket = cores_per_socket;
-   machine->sockets = (socket_t*)malloc(socket_num * sizeof(socket_t));
-   for(int i=0; i < socket_num; ++i) {
-      machine->sockets[i].cores = (core_t*)malloc(cores_per_socket * sizeof(core_t));
+   machine->num_sockets = num_sockets;
+   machine->max_cpu_num = n;
+   machine->sockets = (socket_t*)calloc(num_sockets, sizeof(socket_t));
+   for(int i = 0, s = -1; i < n; ++i) {
+      if(0 == i || cpus[i].package != cpus[i - 1].package) {
+         s++;
+         machine->sockets[s].package = cpus[i].package;
+         machine->sockets[s].node    = cpus[i].node;
+      }
+      if(0 == i || cpus[i].package != cpus[i - 1].package || cpus[i].core != cpus[i - 1].core) {
+         machine->sockets[s].num_cores++;
+      }
    }
 
    // Initialize hardware layout
-   int csocket = 0;
-   int ccore = 0;
-   int cphysical = 0;
-   for(int pnum = 0; pnum < num_hw_cpus; ++pnum) {
-      machine->sockets[csocket].cores[ccore].hwthread_id[cphysical] = pnum;
-      ccore++;
-      if(ccore % cores_per_socket == 0) {
-         ccore = 0;
-         csocket++;
-         if(csocket % socket_num == 0) {
-            csocket = 0;
-            cphysical++;
-         }
+   for(int s = 0; s < num_sockets; ++s) {
+      machine->sockets[s].cores = (core_t*)malloc(machine->sockets[s].num_cores * sizeof(core_t));
+   }
+   machine->cores_per_socket = machine->sockets[0].num_cores;
+   machine->threads_per_core = THREADS_PER_CORE;
+   for(int i = 0, s = -1, c = -1; i < n; ) {
+      if(0 == i || cpus[i].package != cpus[i - 1].package) {
+         s++;
+         c = -1;
       }
-      if((cphysical == THREADS_PER_CORE) && (pnum + 1 < num_hw_cpus)) {
-         std::cout << "ERROR: More CPUs than calculated!\n";
-         exit(-1);
+      core_t* core = &machine->sockets[s].cores[++c];
+      int t = 0;
+      do {
+         if(t < THREADS_PER_CORE) core->hwthread_id[t++] = cpus[i].cpu;
+         i++;
+      } while(i < n && cpus[i].package == cpus[i - 1].package && cpus[i].core == cpus[i - 1].core);
+      if(t < machine->threads_per_core) machine->threads_per_core = t;
+      for(int r = t; r < THREADS_PER_CORE; ++r) {
+         core->hwthread_id[r] = core->hwthread_id[r % t];
       }
    }
+   for(int s = 0; s < num_sockets; ++s) {
+      if(machine->sockets[s].num_cores < machine->cores_per_socket) {
+         machine->cores_per_socket = machine->sockets[s].num_cores;
+      }
+   }
+   free(cpus);
    return machine;
 }
 
@@ -87,13 +162,128 @@ void print_hardware_layout(hl_t* m) {
    using std::cout;
    cout << "Sockets:          " << m->num_sockets        << "\n";
    cout << "Cores/Socket:     " << m->cores_per_socket   << "\n";
+   cout << "Threads/Core:     " << m->threads_per_core   << "\n";
    cout << "Hardware Threads: " << m->max_cpu_num        << "\n";
    for(int i = 0; i < m->num_sockets; ++i) {
-      cout << "Socket " << i << ":\n";
       socket_t msocket = m->sockets[i];
-      for(int j = 0; j < m->cores_per_socket; ++j) {
+      cout << "Socket " << i << " (package " << msocket.package << ", node " << msocket.node << "):\n";
+      for(int j = 0; j < msocket.num_cores; ++j) {
          core_t mcore = msocket.cores[j];
-         cout << "  Core " << j << ": T1= " << mcore.hwthread_id[0] << ",\tT2= " << mcore.hwthread_id[1] << "\n";
+         cout << "  Core " << j << ":";
+         // the first two are the application and helper threads, even without SMT
+         for(int t = 0; t < m->threads_per_core || t < 2; ++t) {
+            cout << (t ? ",\t" : " ") << "T" << (t + 1) << "= " << mcore.hwthread_id[t];
+         }
+         cout << "\n";
+      }
+   }
+}
+
+/* hl_policy_name() - name of an enclave placement policy */
+const char* hl_policy_name(int policy) {
+   switch(policy) {
+      case HL_SCATTER:  return "scatter";
+      case HL_COMPACT:  return "compact";
+      case HL_DISTANCE: return "distance";
+      case HL_CPUS:     return "cpu list";
+      default:          return "unknown";
+   }
+}
+
+/* socket_order() - order the sockets to fill under @policy */
+static void socket_order(hl_t* m, int policy, int* order) {
+   for(int s = 0; s < m->num_sockets; ++s) order[s] = s;
+   if(HL_DISTANCE != policy) return;
+   // greedily add the socket with the least total distance to the ones already chosen
+   for(int k = 1; k < m->num_sockets; ++k) {
+      int best = k;
+      long best_dist = -1;
+      for(int c = k; c < m->num_sockets; ++c) {
+         long dist = 0;
+         for(int u = 0; u < k; ++u) {
+            dist += numa_distance(m->sockets[order[u]].node, m->sockets[order[c]].node);
+         }
+         if(-1 == best_dist || dist < best_dist) {
+            best = c;
+            best_dist = dist;
+         }
+      }
+      int tmp = order[k];
+      order[k] = order[best];
+      order[best] = tmp;
+   }
+}
+
+/* place_cpu() - the slot of the core holding hardware thread @cpu (its next sibling helps) */
+static bool place_cpu(hl_t* m, int cpu, hl_slot* slot) {
+   for(int s = 0; s < m->num_sockets; ++s) {
+      for(int c = 0; c < m->sockets[s].num_cores; ++c) {
+         core_t* core = &m->sockets[s].cores[c];
+         for(int t = 0; t < THREADS_PER_CORE; ++t) {
+            if(core->hwthread_id[t] != cpu) continue;
+            for(int r = 0; r < THREADS_PER_CORE; ++r) {
+               slot->core.hwthread_id[r] = core->hwthread_id[(t + r) % THREADS_PER_CORE];
+            }
+            slot->socket = s;
+            slot->node   = m->sockets[s].node;
+            return true;
+         }
+      }
+   }
+   return false;
+}
+
+/**
+ * hl_place() - map the enclaves to cores
+ * @m            - the hardware layout
+ * @policy       - the placement policy
+ * @cpus         - the hardware threads of the application threads (HL_CPUS), e.g. "0,2,8-11"
+ * @num_enclaves - the number of enclaves
+ */
+hl_slot* hl_place(hl_t* m, int policy, const char* cpus, int num_enclaves) {
+   hl_slot* slots = (hl_slot*)malloc(num_enclaves * sizeof(hl_slot));
+   if(HL_CPUS == policy) {
+      const char* p = cpus;
+      int first = 0, last = -1, i = 0;
+      while(i < num_enclaves) {
+         if(first > last) {
+            // parse the next item of the list
+            char* end;
+            first = last = strtol(p, &end, 10);
+            if(end == p) break;
+            if('-' == *end) last = strtol(end + 1, &end, 10);
+            p = (',' == *end) ? end + 1 : end;
+            continue;
+         }
+         if(!place_cpu(m, first, &slots[i])) {
+            std::cout << "ERROR: CPU " << first << " is not usable!\n";
+            exit(-1);
+         }
+         first++;
+         i++;
+      }
+      if(i < num_enclaves) {
+         std::cout << "ERROR: the CPU list has fewer CPUs than enclaves!\n";
+         exit(-1);
+      }
+      return slots;
+   }
+
+   int* order = (int*)malloc(m->num_sockets * sizeof(int));
+   socket_order(m, policy, order);
+   for(int i = 0; i < num_enclaves; ++i) {
+      int s, c;
+      if(HL_SCATTER == policy) {
+         s = order[i % m->num_sockets];
+         c = (i / m->num_sockets) % m->cores_per_socket;
+      } else {
+         s = order[(i / m->cores_per_socket) % m->num_sockets];
+         c = i % m->cores_per_socket;
       }
+      slots[i].core   = m->sockets[s].cores[c];
+      slots[i].socket = s;
+      slots[i].node   = m->sockets[s].node;
    }
+   free(order);
+   return slots;
 }
@@ -4,33 +4,55 @@
 #define GNU_SOURCE
 #include <iostream>
 #include <stdio.h>
-#include <string>
-#include <sstream>
-FILE *popen(const char *command, const char *mode);
-int pclose(FILE *stream);
 
-#define THREADS_PER_CORE 2
+#ifndef SYSFS_CPU_DIR
+#define SYSFS_CPU_DIR "/sys/devices/system/cpu"
+#endif
 
+#define THREADS_PER_CORE 8   // most hardware threads per core used (a core without SMT has one)
+
+/* core_t holds the usable hardware threads of a core (the first ones repeat when it has fewer) */
 struct core_t {
    int hwthread_id[THREADS_PER_CORE];
 };
 
 struct socket_t {
    core_t*  cores;
+   int      num_cores;     // usable cores of the socket
+   int      package;       // physical package id
+   int      node;          // NUMA node of the socket's first hardware thread
 };
 
 struct hardware_layout_t {
    socket_t*   sockets;
    int         num_sockets;
-   int         cores_per_socket;
-   int         max_cpu_num;
+   int         cores_per_socket;   // usable cores of the smallest socket
+   int         threads_per_core;   // usable hardware threads of the smallest core
+   int         max_cpu_num;        // usable hardware threads
 };
 typedef hardware_layout_t hl_t;
 
+/* Placement policies of the enclaves */
+enum hl_policy {
+   HL_SCATTER,       // round-robin across the sockets
+   HL_COMPACT,       // fill the cores of a socket before the next one
+   HL_DISTANCE,      // fill sockets in order of NUMA distance to the ones already used
+   HL_CPUS           // the application threads run on a list of hardware threads
+};
+
+/* hl_slot is where an enclave runs */
+struct hl_slot {
+   core_t   core;          // the hardware threads of its application thread and helper thread
+   int      socket;        // index of its socket in the layout
+   int      node;          // NUMA node of its socket (its memory placement)
+};
+
 
 // Public hardware layout interface
 hl_t* get_hardware_layout(void);
 void free_hardware_layout(hl_t* m);
 void print_hardware_layout(hl_t* m);
+hl_slot* hl_place(hl_t* m, int policy, const char* cpus, int num_enclaves);
+const char* hl_policy_name(int policy);
 
 #endif //HARDWARE_LAYOUT_H
@@ -12,17 +12,54 @@
  * The helper thread loops and updates the intermediate layer from the opbuffer. It
  * then attempts to update the index layer based on a set frequency.
  *
+ * An idling helper thread (-J) does not busy-loop on an empty opbuffer: it spins through a
+ * few empty passes with pause (which hands the core to its SMT sibling), then finishes the
+ * index layer work and sleeps on a futex until the application thread publishes an
+ * operation, or for HLP_SLEEP_MS so that periodic maintenance still runs.
+ *
+ * With lending (-Y), a helper thread whose opbuffer is empty once the run started brings
+ * its index layer up to date and then runs reads itself, as a second reader of the
+ * enclave on its own hardware thread. It returns to helper duty after each LEND_BATCH
+ * reads if the opbuffer holds lend_depth pending operations, and at the latest after
+ * LEND_SLICE_MS, so the index layer lags the application thread's updates by a bounded
+ * amount. The reads have their own reclamation record: the helper's record only passes
+ * a quiescent state after draining the opbuffer.
+ *
+ * In inline mode an enclave has no helper thread: its application thread runs the same
+ * maintenance pass itself (updating the index layer every time) once every few operations.
+ *
  * NOTE: Index layer updates functions are based on No Hotspot's background.c
  */
 
 #include <assert.h>
 #include <atomic_ops.h>
 #include <pthread.h>
+#include <time.h>
 #include <unistd.h>
+#include "cold.h"
 #include "common.h"
 #include "enclave.h"
+#include "learned_index.h"
+#include "mchunk.h"
+#include "migrate.h"
+#include "node_pool.h"
+#include "reclaim.h"
 #include "skiplist.h"
 
+extern bool base_malloc;
+
+/* mnode_free()/inode_free() - free retired intermediate and index nodes */
+static void mnode_free(void* mnode, int enclave_id) {
+   mnode_delete((mnode_t*)mnode, enclave_id);
+}
+static void inode_free(void* inode, int enclave_id) {
+   inode_delete((inode_t*)inode, enclave_id);
+}
+/* inode_free_base() - free a retired index node allocated during initial population */
+static void inode_free_base(void* inode, int unused) {
+   free(inode);
+}
+
 void reset_index(enclave* obj) {
    mnode_t* node = obj->get_sentinel()->intermed;
    node->level = node->node->level = 1;
@@ -35,28 +72,89 @@ void reset_index(enclave* obj) {
 }
 
 
+/**
+ * bg_share_node() - repoint the intermediate nodes after @mnode which enter the data layer
+ *  through @old (their own keys were unlinked) to @node
+ * @obj   - the enclave object
+ * @mnode - the last intermediate node which keeps its entry
+ * @old   - the entry shared with the previous intermediate node
+ * @node  - the new entry
+ *
+ * Note: the intermediate node of an unlinked key shares the entry of the intermediate node
+ * before it, so it is repointed with it whatever the key range of the relocation
+ */
+void bg_share_node(enclave* obj, mnode_t* mnode, node_t* old, node_t* node) {
+   for(mnode_t* m = mnode->next; NULL != m && m->node == old; m = m->next) {
+      m->node = node;
+      if(obj->chunks) mchunk_repoint(obj->chunks, m);
+   }
+}
+
 /**
  * bg_mremove - starts the physical removal of @mnode
+ * @obj   - the enclave object
  * @prev  - the node before the one to remove
  * @mnode - the node to finish removing
- * @enclave_id  - enclave
  * returns 1 if deleted, 0 if not
  *
  * Note: since this operates on the intermediate layer alone,
  * no synchronization techniques are needed
  */
-int bg_mremove(mnode_t* prev, mnode_t* mnode, int enclave_id) {
+int bg_mremove(enclave* obj, mnode_t* prev, mnode_t* mnode) {
    int result = 0;
    assert(prev);
    assert(mnode);
    if(mnode->level == 0 && mnode->marked) {
+      bg_share_node(obj, mnode, mnode->node, prev->node);
       prev->next = mnode->next;
-      mnode_delete(mnode, enclave_id);
+      if(obj->chunks) {
+         mchunk_remove(obj->chunks, prev, mnode, obj->limbo);
+      }
+      rc_retire(obj->limbo, mnode, mnode_free, obj->get_enclave_num());
       result = 1;
    }
    return result;
 }
 
+/**
+ * bg_sweep - unlink the logically deleted data layer nodes of the gap after @mnode
+ * @obj   - the enclave object
+ * @mnode - the intermediate node whose gap (up to the next intermediate key) holds deleted keys
+ * returns true if the gap was swept, false if it should be swept again
+ *
+ * Note: deleted nodes are moved to the removal state under the relocation lock (cold
+ * segments keep the deleted keys they absorb), then unlinked and retired like moved nodes
+ */
+static bool bg_sweep(enclave* obj, mnode_t* mnode) {
+   node_t*  swept[SWEEP_HOPS];
+   mnode_t* bound = mnode->next;
+   node_t*  node = mnode->node;
+   int      n = 0, hops = 0;
+   if(!mig_trylock()) return false;
+   while(node == node->val) node = node->prev;
+   for(; hops < SWEEP_HOPS && NULL != node; ++hops) {
+      if(NULL != bound && node->key >= bound->key) break;
+      // (the sentinel is the only node without a prev)
+      if(NULL == node->val && NULL != node->prev && CAS(&node->val, NULL, node)) {
+         swept[n++] = node;
+      }
+      node = node->next;
+   }
+   AO_nop_full();
+   mig_unlock();
+   if(n == 0) return true;
+
+   for(int i = 0; i < n; ++i) {
+      dl_unlink(swept[i]);
+   }
+   mig_request_repoint(swept[0]->key, swept[n - 1]->key);
+   for(int i = 0; i < n; ++i) {
+      rc_retire_staged(obj->limbo, (void*)swept[i], dl_node_free, 0, MIG_GRACE_PERIODS);
+   }
+   obj->mig->swept += n;
+   return hops < SWEEP_HOPS;
+}
+
 /**
  * bg_trav_mnodes - traverse intermediate nodes and remove if possible
  * @obj - the enclave object for reference
@@ -68,9 +166,13 @@ static void bg_trav_mnodes(enclave* obj) {
    zone_access_check(zone, prev, &obj->bg_local_accesses, &obj->bg_foreign_accesses, obj->index_ignore);
    zone_access_check(zone, node, &obj->bg_local_accesses, &obj->bg_foreign_accesses, obj->index_ignore);
 #endif
+   if(prev->sweep) { prev->sweep = !bg_sweep(obj, prev); }
 
    while (NULL != node) {
-      if(bg_mremove(prev, node, obj->get_enclave_num())) {
+      if(node->sweep) { node->sweep = !bg_sweep(obj, node); }
+      bool sweep = node->sweep;
+      if(bg_mremove(obj, prev, node)) {
+         prev->sweep |= sweep;   // the gap joins the previous one
          node = prev->next;
       } else {
          if(!node->marked)          { ++obj->non_del; }
@@ -85,13 +187,11 @@ static void bg_trav_mnodes(enclave* obj) {
 }
 
 /**
- * update_intermediate_layer() - updates intermediate layer from local op array
- * @obj - enclave object for reference
- * @job - operation to publish to the intermediate layer
+ * bg_find_mnode() - find the intermediate node with the largest key <= @test_key
+ * @obj      - the enclave object
+ * @test_key - the search key
  */
-void update_intermediate_layer(enclave* obj, op_t* job) {
-   int      enclave_id      = obj->get_enclave_num();
-   sl_key_t test_key = job->key;
+mnode_t* bg_find_mnode(enclave* obj, sl_key_t test_key) {
    inode_t* item     = obj->get_sentinel();
 #ifdef ADDRESS_CHECKING
    zone_access_check(numa_zone, item, &obj->bg_local_accesses, &obj->bg_foreign_accesses, obj->index_ignore);
@@ -127,26 +227,68 @@ void update_intermediate_layer(enclave* obj, op_t* job) {
       item = next_item;
    }
 
-   // intermediate layer traversal and actual update
+   // intermediate layer traversal
    while(1) {
       next = mnode->next;
 #ifdef ADDRESS_CHECKING
       zone_access_check(numa_zone, next, &obj->bg_local_accesses, &obj->bg_foreign_accesses, obj->index_ignore);
 #endif
-      if(!next || next->key > test_key) {
-         // if node pointer is not NULL, we know it's an insert
-         if(job->node != NULL) {
-            if(mnode->key == test_key) {
-               if(mnode->marked) { mnode->marked = false; }
-            } else {
-               mnode->next = mnode_new(next, job->node, 0, enclave_id);
-            }
-         } else {
-            if(mnode->key == test_key) { mnode->marked = true; }
+      if(!next || next->key > test_key) break;
+      mnode = next;
+   }
+   return mnode;
+}
+
+/**
+ * update_intermediate_layer() - updates intermediate layer from local op array
+ * @obj - enclave object for reference
+ * @job - operation to publish to the intermediate layer
+ */
+void update_intermediate_layer(enclave* obj, op_t* job) {
+   int      enclave_id = obj->get_enclave_num();
+   sl_key_t test_key   = job->key;
+   mnode_t* mnode      = bg_find_mnode(obj, test_key);
+   if(NULL != obj->mig) { cold_update(obj, test_key); }
+
+   // if node pointer is not NULL, we know it's an insert
+   if(job->node != NULL) {
+      if(mnode->key == test_key) {
+         if(mnode->marked) {
+            mnode->marked = false;
+            obj->size->indexed++;
          }
-         break;
+         if(mnode->node->key != test_key) {
+            // the node of the deleted key was unlinked: take the new one
+            node_t* node = job->node;
+            if(node->val == node) node = dl_entry(node, test_key);
+            if(node == NULL || node->key != test_key) return;
+            node_t* old = mnode->node;
+            mnode->node = node;
+            if(obj->chunks) mchunk_repoint(obj->chunks, mnode);
+            bg_share_node(obj, mnode, old, node);
+         }
+      } else {
+         node_t* node = job->node;
+         if(node->val == node) {
+            // the node was relocated since it was published (keys absorbed by a cold
+            // segment get no intermediate node: the segment node has another key)
+            node = dl_entry(node, test_key);
+            if(node == NULL || node->key != test_key) return;
+         }
+         mnode->next = mnode_new(mnode->next, node, 0, enclave_id);
+         obj->model_changes++;
+         obj->size->indexed++;
+         if(obj->chunks) {
+            mchunk_insert(obj->chunks, mnode, mnode->next);
+         }
+         bg_share_node(obj, mnode->next, mnode->node, node);
       }
-      mnode = next;
+   } else {
+      if(mnode->key == test_key && !mnode->marked) {
+         mnode->marked = true;
+         obj->size->indexed--;
+      }
+      if(obj->deferred) { mnode->sweep = true; }
    }
 }
 
@@ -248,14 +390,15 @@ static int bg_raise_ilevel(inode_t *iprev, inode_t *iprev_tall, int height, int
 
 /**
  * bg_lower_ilevel - lower the index level
+ * @obj     - the enclave object
  * @new_low - the first index item in the second lowest level
- * @enclave_id - enclave
  *
  * Note: the lowest index level is removed by nullifying
  * the reference to the lowest level from the second lowest level.
  */
-void bg_lower_ilevel(inode_t *new_low, int enclave_id) {
+void bg_lower_ilevel(enclave* obj, inode_t *new_low) {
    inode_t *old_low = new_low->down;
+   rc_free_fn free_fn = base_malloc ? inode_free_base : inode_free;
 
    /* remove the lowest index level */
    while (NULL != new_low) {
@@ -268,11 +411,32 @@ void bg_lower_ilevel(inode_t *new_low, int enclave_id) {
    /* garbage collect the old low level */
    while (NULL != old_low) {
       inode_t* next = old_low->right;
-      inode_delete(old_low, enclave_id);
+      rc_retire(obj->limbo, old_low, free_fn, obj->get_enclave_num());
       old_low = next;
    }
 }
 
+/**
+ * update_learned_model() - rebuild and republish the learned model once enough
+ *  keys have been added to the intermediate layer since the last build
+ * @obj - the enclave object
+ */
+static void update_learned_model(enclave* obj) {
+   sl_model* old = obj->model;
+   if(old != NULL) {
+      long threshold = old->num_keys / LEARNED_REBUILD_RATIO;
+      if(threshold < LEARNED_MIN_REBUILD) threshold = LEARNED_MIN_REBUILD;
+      if(obj->model_changes < threshold) return;
+   }
+   obj->model_changes = 0;
+   sl_model* model = model_build(obj->get_sentinel()->intermed);
+   BARRIER();
+   obj->model = model;
+   if(old != NULL) {
+      rc_retire(obj->limbo, old, model_free, 0);
+   }
+}
+
 /**
  *  update_index_layer() - updates the index layer based on the local intermediate layer
  *  @obj - the enclave object
@@ -347,12 +511,17 @@ void update_index_layer(enclave* obj) {
    // if needed, remove the lowest index level
    if (obj->tall_del > obj->non_del * 10) {
       if (NULL != inodes[1]) {
-         bg_lower_ilevel(inodes[1], enclave_id); // level above
+         bg_lower_ilevel(obj, inodes[1]); // level above
          #ifdef BG_STATS
          ++obj->shadow_stats.lowers;
          #endif
       }
    }
+
+   if(obj->learned) {
+      update_learned_model(obj);
+   }
+   rc_reclaim(obj->limbo);
 }
 
 /**
@@ -382,6 +551,175 @@ void node_remove(node_t* prev, node_t* node) {
    assert(prev->next != prev);
 }
 
+/**
+ * bg_find_node() - find the live data layer node of @key
+ * @obj - the enclave object
+ * @key - the search key
+ * returns NULL if @key is absent, logically deleted or being moved
+ */
+node_t* bg_find_node(enclave* obj, sl_key_t key) {
+   node_t* node = bg_find_mnode(obj, key)->node;
+   node_t* next;
+   while(1) {
+      while(node == node->val) node = node->prev;
+      next = node->next;
+      if(NULL != next && next->val == next) {
+         node_remove(node, next);
+         continue;
+      }
+      if(NULL == next || next->key > key) break;
+      node = next;
+   }
+   val_t val = node->val;
+   if(node->key != key || val == NULL || val == DL_MOVING) return NULL;
+   return node;
+}
+
+/**
+ * dl_entry() - the data layer node which holds @key, reached from the removed @node
+ * @node - a data layer node in the removal state
+ * @key  - the key
+ * returns the node of @key, the cold segment which covers @key, or the last node before
+ *  @key if it was unlinked; NULL while the segment before @key is under construction
+ */
+node_t* dl_entry(node_t* node, sl_key_t key) {
+   node_t* next;
+   while(1) {
+      while(node == node->val) node = node->prev;
+      next = node->next;
+      if(NULL != next && next->val == next) {
+         node_remove(node, next);
+         continue;
+      }
+      if(NULL == next || next->key > key) break;
+      node = next;
+   }
+   if(node->seg && node->val == DL_MOVING) return NULL;
+   return node;
+}
+
+/**
+ * dl_unlink() - physically remove @node from the data layer and repair the prev
+ *  pointer of its successor
+ * @node - a data layer node in the removal state
+ */
+void dl_unlink(node_t* node) {
+   node_t *prev = node->prev, *next;
+   assert(node->val == node);
+   while(1) {
+      while(prev == prev->val) prev = prev->prev;
+      next = prev->next;
+      if(next == node) {
+         node_remove(prev, node);
+         continue;
+      }
+      if(NULL == next || next->key > node->key) break;
+      if(next->val == next) {
+         node_remove(prev, next);
+         continue;
+      }
+      if(next->key == node->key) break;   // unlinked, prev->next is the replacement
+      prev = next;
+   }
+
+   // the successor may still point back to @node
+   node_t* succ = node->next;
+   if(NULL != succ && succ->key == 0 && succ->val == succ) succ = succ->next;
+   if(NULL == succ || succ->prev != node) return;
+   do {
+      prev = node->prev;
+      while(prev == prev->val) prev = prev->prev;
+      succ->prev = prev;
+      AO_nop_full();
+   } while(prev == prev->val);
+}
+
+/**
+ * helper_start() - prepare the maintenance of the enclave's layers
+ * @obj - the enclave object
+ */
+void helper_start(enclave* obj) {
+   if(!obj->hlp_rc->online) rc_online(obj->hlp_rc);
+
+   if(obj->reset_index) {
+      obj->reset_index = false;
+      reset_index(obj);
+   }
+   if(obj->chunks && obj->get_sentinel()->intermed->chunk == 0) {
+      mchunk_build(obj->chunks, obj->get_sentinel()->intermed);
+   }
+}
+
+/**
+ * helper_pass() - a maintenance pass over the enclave's layers
+ * @obj        - the enclave object
+ * @job        - holds the operations consumed from the opbuffer
+ * @update_all - update the index layer on this pass (else on the update frequency)
+ *
+ * returns the number of operations consumed from the opbuffer
+ *
+ * Note: the pass ends in a quiescent state of the helper's reclamation record, so a
+ *  retired node is only freed once the opbuffer was drained after its retirement
+ */
+int helper_pass(enclave* obj, op_t* job, bool update_all) {
+   int consumed = 0;
+   if(obj->reset_index) {
+      // population is done: rebuild the index layer from the intermediate layer
+      obj->reset_index = false;
+      reset_index(obj);
+   }
+   // Update intermediate layer from op array
+   op_t* cur_job = job;
+   while((cur_job = obj->opbuffer_remove(&cur_job))) {
+      update_intermediate_layer(obj, cur_job);
+      consumed++;
+   }
+   // Update index layer on predetermined frequency
+   if(update_all || rand_range_re(&obj->update_seed, 100) < obj->update_freq) {
+      update_index_layer(obj);
+      obj->index_check();
+   }
+   // Follow remote hotspots, compact the data layer and maintain cold segments
+   if(NULL != obj->mig) {
+      mig_repoint(obj);
+      mig_process(obj);
+      mig_compact(obj);
+      cold_maintain(obj);
+   }
+   rc_quiescent(obj->hlp_rc);
+   return consumed;
+}
+
+/**
+ * lend() - lend the helper thread to the readers until maintenance is due or the run stops
+ * @obj    - the enclave object
+ * @params - the lent reader's parameters
+ *
+ * Returns false once the run is stopped.
+ */
+static bool lend(enclave* obj, app_param* params) {
+   struct timespec t0, t1;
+   bool running = true;
+   obj->lending = true;
+   AO_nop_full();   // the main thread stops the run, then waits for lending to clear
+   if(AO_load_full(params->stop) != 0) {
+      obj->lending = false;
+      return false;
+   }
+   obj->lends++;
+   rc_online(obj->lend_rc);
+   clock_gettime(CLOCK_MONOTONIC, &t0);
+   while((running = lend_reads(obj, params, LEND_BATCH))) {
+      if(obj->finished || obj->opbuffer_pending() >= obj->lend_depth) break;
+      clock_gettime(CLOCK_MONOTONIC, &t1);
+      if((t1.tv_sec - t0.tv_sec) * 1000L + (t1.tv_nsec - t0.tv_nsec) / 1000000L >= LEND_SLICE_MS) break;
+   }
+   rc_offline(obj->lend_rc);
+   AO_nop_full();
+   obj->lending = false;
+   return running;
+}
+
 /**
  * helper_loop() - defines the execution flow of the helper thread in each enclave
  * @args - the enclave object that owns the helper thread
@@ -389,29 +727,54 @@ void node_remove(node_t* prev, node_t* node) {
 void* helper_loop(void* args) {
    enclave* obj         = (enclave*)args;
    op_t*    local_job   = new op_t();
-   bool     update_all  = obj->populate_init;
    // Pin to CPU
    cpu_set_t cpuset;
    CPU_ZERO(&cpuset);
    CPU_SET(obj->get_thread_id(HLP_IDX), &cpuset);
    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
-
-   if(obj->reset_index) {
-      obj->reset_index = false;
-      reset_index(obj);
+   np_thread_init(helper_pools[obj->get_enclave_num()]);
+   if(obj->sched_idle) {
+      struct sched_param param = {0};
+      pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
    }
+   helper_start(obj);
 
+   int empty = 0;   // consecutive passes which found the opbuffer empty
+   bool lendable = (obj->lend_depth > 0);
+   bool stale = true;   // operations were consumed since the index layer was last brought up to date
+   app_param lparams;
    while(1) {
       if(obj->finished) break;
-      // Update intermediate layer from op array
-      op_t* cur_job = local_job;
-      while((cur_job = obj->opbuffer_remove(&cur_job))) {
-         update_intermediate_layer(obj, cur_job);
+      int consumed = helper_pass(obj, local_job, obj->populate_init);
+      if(lendable && NULL != obj->lend_params) {
+         if(0 != consumed) {
+            stale = true;
+            continue;
+         }
+         if(stale) {
+            // the lent reads only see the index layer as it is now
+            update_index_layer(obj);
+            lparams = *obj->lend_params;
+            lparams.seed = rand_r(&obj->update_seed);
+            stale = false;
+         }
+         lendable = lend(obj, &lparams);
+         continue;
+      }
+      if(0 != consumed || !obj->idling) {
+         empty = 0;
+         continue;
       }
-      // Update index layer on predetermined frequency
-      if(update_all || rand_range_re(&obj->update_seed, 100) < obj->update_freq) {
-         update_index_layer(obj);
+      if(++empty < HLP_SPIN_PASSES) {
+         for(int i = 0; i < HLP_SPIN_PAUSES; ++i) PAUSE();
+         continue;
       }
+      // nothing to do: finish the index layer work, then sleep until an operation is published
+      update_index_layer(obj);
+      obj->helper_sleep();
+      empty = 0;
    }
+   // stay online while stopped: the intermediate layer and the pending repoint requests
+   // still reference data layer nodes, which must not be freed before they are repointed
    return NULL;
 }
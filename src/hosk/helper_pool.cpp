@@ -0,0 +1,136 @@
+/*
+ * helper_pool.cpp: pool of helper threads shared by the enclaves of a socket
+ *
+ * Author: Henry Daly, 2018
+ */
+
+/**
+ * Module Overview:
+ *
+ * By default every enclave has its own helper thread, pinned to the SMT sibling of its
+ * application thread. With the helper pool, each socket instead runs a few helper threads
+ * (on hardware threads of their own) which serve all the enclaves of the socket: the
+ * enclaves are dealt out to the socket's helpers, and each helper runs helper_pass() over
+ * its own enclaves round after round.
+ *
+ * A helper whose enclaves had no pending operations in a round steals a pass over the
+ * enclave of the socket with the most pending operations (at least HP_STEAL_MIN). A pass
+ * holds the pass lock of its enclave, so a single thread at a time maintains the layers,
+ * allocator and node cache of an enclave, as the helper thread did. The reclamation
+ * record of an enclave's helper is shared by whichever thread runs its passes: it stays
+ * online and passes a quiescent state at the end of every pass.
+ */
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "enclave.h"
+#include "helper_pool.h"
+#include "node_pool.h"
+
+/* hp_pass() - run a pass over @obj unless another helper is in one or its helper is stopped */
+static bool hp_pass(enclave* obj, op_t* job) {
+   if(0 != obj->pass_lock || !CAS(&obj->pass_lock, 0, 1)) return false;
+   bool done = false;
+   if(!obj->finished) {
+      np_thread_init(helper_pools[obj->get_enclave_num()]);
+      helper_pass(obj, job, obj->populate_init);
+      done = true;
+   }
+   AO_fetch_and_sub1_full(&obj->pass_lock);   // keeps a start or stop waiting for the pass
+   return done;
+}
+
+/* hp_loop() - defines the execution flow of a pool helper thread */
+static void* hp_loop(void* args) {
+   hp_helper* h = (hp_helper*)args;
+   hp_pool* pool = h->pool;
+   op_t job;
+
+   // Pin to CPU
+   cpu_set_t cpuset;
+   CPU_ZERO(&cpuset);
+   CPU_SET(h->cpu, &cpuset);
+   pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+
+   while(0 == AO_load_full(&pool->stop)) {
+      bool idle = true;
+      for(int i = 0; i < h->num_own; ++i) {
+         if(h->own[i]->opbuffer_pending() > 0) idle = false;
+         if(hp_pass(h->own[i], &job)) h->passes++;
+      }
+      if(!idle) continue;
+      // steal from the busiest enclave of the socket
+      enclave* victim = NULL;
+      int most = HP_STEAL_MIN - 1;
+      for(int i = 0; i < h->num_peers; ++i) {
+         int pending = h->peers[i]->opbuffer_pending();
+         if(pending > most) {
+            most = pending;
+            victim = h->peers[i];
+         }
+      }
+      if(NULL != victim && hp_pass(victim, &job)) h->stolen++;
+   }
+   return NULL;
+}
+
+/**
+ * hp_start() - start the helper pool (once the helpers of the pooled enclaves were started)
+ * @enclaves     - all enclaves (each one is served by a helper of its socket)
+ * @num_enclaves - the number of enclaves
+ * @cpus         - the hardware thread of each helper
+ * @sockets      - the socket of each helper (every socket of an enclave needs a helper)
+ * @num_helpers  - the number of helpers
+ */
+hp_pool* hp_start(enclave** enclaves, int num_enclaves, int* cpus, int* sockets, int num_helpers) {
+   hp_pool* pool = (hp_pool*)calloc(1, sizeof(hp_pool));
+   pool->helpers = (hp_helper*)calloc(num_helpers, sizeof(hp_helper));
+   pool->num_helpers = num_helpers;
+   for(int h = 0; h < num_helpers; ++h) {
+      hp_helper* helper = &pool->helpers[h];
+      helper->pool   = pool;
+      helper->cpu    = cpus[h];
+      helper->socket = sockets[h];
+      helper->own    = (enclave**)malloc(num_enclaves * sizeof(enclave*));
+      helper->peers  = (enclave**)malloc(num_enclaves * sizeof(enclave*));
+   }
+   for(int i = 0; i < num_enclaves; ++i) {
+      // the enclave is a peer of every helper of its socket and owned by the least loaded one
+      int socket = enclaves[i]->get_socket_num();
+      hp_helper* owner = NULL;
+      for(int h = 0; h < num_helpers; ++h) {
+         hp_helper* helper = &pool->helpers[h];
+         if(helper->socket != socket) continue;
+         helper->peers[helper->num_peers++] = enclaves[i];
+         if(NULL == owner || helper->num_own < owner->num_own) owner = helper;
+      }
+      if(NULL == owner) {
+         printf("ERROR: no pool helper on socket %d\n", socket);
+         exit(1);
+      }
+      owner->own[owner->num_own++] = enclaves[i];
+   }
+   for(int h = 0; h < num_helpers; ++h) {
+      pthread_create(&pool->helpers[h].thread, NULL, hp_loop, (void*)&pool->helpers[h]);
+   }
+   return pool;
+}
+
+/* hp_stop() - stop the helper pool (once the helpers of the enclaves were stopped) */
+void hp_stop(hp_pool* pool) {
+   AO_store_full(&pool->stop, 1);
+   for(int h = 0; h < pool->num_helpers; ++h) {
+      pthread_join(pool->helpers[h].thread, NULL);
+   }
+}
+
+/* hp_free() - free a stopped helper pool */
+void hp_free(hp_pool* pool) {
+   for(int h = 0; h < pool->num_helpers; ++h) {
+      free(pool->helpers[h].own);
+      free(pool->helpers[h].peers);
+   }
+   free(pool->helpers);
+   free(pool);
+}
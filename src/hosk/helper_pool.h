@@ -0,0 +1,42 @@
+/*
+ * Interface for the helper thread pool
+ *
+ * Author: Henry Daly, 2018
+ */
+#ifndef HELPER_POOL_H_
+#define HELPER_POOL_H_
+
+#include <pthread.h>
+#include "common.h"
+
+#define HP_STEAL_MIN    64     // pending operations which make another helper's enclave worth a pass
+
+class enclave;
+struct hp_pool;
+
+/* hp_helper is a pool thread serving the enclaves of its socket */
+struct hp_helper {
+   hp_pool*       pool;
+   pthread_t      thread;
+   int            cpu;           // hardware thread the helper is pinned to
+   int            socket;
+   enclave**      own;           // enclaves the helper passes over on every round
+   int            num_own;
+   enclave**      peers;         // all enclaves of the socket (steal candidates)
+   int            num_peers;
+   unsigned long  passes;        // passes over its own enclaves
+   unsigned long  stolen;        // passes over another helper's enclaves
+};
+
+/* hp_pool is the set of helper threads replacing the per-enclave helper threads */
+struct hp_pool {
+   hp_helper*     helpers;
+   int            num_helpers;
+   VOLATILE AO_t  stop;
+};
+
+hp_pool* hp_start(enclave** enclaves, int num_enclaves, int* cpus, int* sockets, int num_helpers);
+void     hp_stop(hp_pool* pool);
+void     hp_free(hp_pool* pool);
+
+#endif /* HELPER_POOL_H_ */
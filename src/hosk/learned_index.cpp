@@ -0,0 +1,128 @@
+/*
+ * learned_index.cpp: piecewise-linear model over the intermediate layer
+ *
+ * Author: Henry Daly, 2018
+ */
+
+/**
+ * Module Overview:
+ *
+ * In learned index mode, the helper thread periodically snapshots the (unmarked)
+ * intermediate layer of its enclave into a sorted key array and fits a piecewise-linear
+ * model over it. Segments are built greedily: a segment is extended for as long as some
+ * line through its first point predicts every position within LEARNED_ERROR. The model
+ * is read-only once published; the application thread predicts a position, then binary
+ * searches a window of 2 * LEARNED_ERROR + 3 slots for the largest key <= the search key.
+ *
+ * Keys inserted after a build are not modeled, but since every modeled entry is a
+ * data layer node, they are still reached by the data layer traversal that follows.
+ * When a modeled data layer node is replaced, its entry is repointed in place (the
+ * helper finds the entries of a key range with model_first()).
+ */
+
+#include <numa.h>
+#include "learned_index.h"
+
+/* model_size() - bytes needed for a model of n keys */
+static size_t model_size(long n) {
+   return sizeof(sl_model) + n * (sizeof(sl_key_t) + sizeof(node_t*) + sizeof(lm_segment));
+}
+
+/**
+ * model_build() - snapshot the intermediate layer and fit the model
+ * @head - the sentinel intermediate node of the enclave
+ */
+sl_model* model_build(mnode_t* head) {
+   long n = intermed_layer_size(head);
+   if(head->marked) n++;   // the sentinel is always modeled
+   sl_model* m = (sl_model*)numa_alloc_local(model_size(n));
+   m->bytes = model_size(n);
+   m->keys  = (sl_key_t*)(m + 1);
+   m->nodes = (node_t**)(m->keys + n);
+   m->segs  = (lm_segment*)(m->nodes + n);
+
+   // snapshot keys in order
+   long i = 0;
+   for(mnode_t* cur = head; cur && i < n; cur = cur->next) {
+      // (an intermediate node whose key was unlinked shares the entry of the one before)
+      if(cur != head && (cur->marked || cur->node == m->nodes[i - 1])) continue;
+      m->keys[i]  = cur->key;
+      m->nodes[i] = cur->node;
+      i++;
+   }
+   m->num_keys = i;
+
+   // greedily fit segments (shrinking cone)
+   long s = 0;
+   long start = 0;
+   while(start < m->num_keys) {
+      double lo = 0.0, hi = 1e300;
+      long end = start + 1;
+      for(; end < m->num_keys; ++end) {
+         double dx = (double)(m->keys[end] - m->keys[start]);
+         double dy = (double)(end - start);
+         double nlo = (dy - LEARNED_ERROR) / dx;
+         double nhi = (dy + LEARNED_ERROR) / dx;
+         if(nlo > hi || nhi < lo) break;
+         if(nlo > lo) lo = nlo;
+         if(nhi < hi) hi = nhi;
+      }
+      m->segs[s].first_key = m->keys[start];
+      m->segs[s].start     = start;
+      m->segs[s].slope     = (end == start + 1) ? 0.0 : (hi >= 1e300 ? lo : (lo + hi) / 2);
+      s++;
+      start = end;
+   }
+   m->num_segs = s;
+   return m;
+}
+
+/* model_first() - position of the first modeled key >= @key (num_keys if none) */
+long model_first(sl_model* m, sl_key_t key) {
+   long lo = 0, hi = m->num_keys;
+   while(lo < hi) {
+      long mid = (lo + hi) / 2;
+      if(m->keys[mid] < key) lo = mid + 1;
+      else                   hi = mid;
+   }
+   return lo;
+}
+
+/* model_free() - free a retired model */
+void model_free(void* model, int unused) {
+   sl_model* m = (sl_model*)model;
+   numa_free(m, m->bytes);
+}
+
+/**
+ * model_lookup() - return the modeled data layer node with the largest key <= @key
+ * @model - the published model
+ * @key   - the search key
+ */
+node_t* model_lookup(sl_model* m, sl_key_t key) {
+   // find the segment
+   long lo = 0, hi = m->num_segs - 1;
+   while(lo < hi) {
+      long mid = (lo + hi + 1) / 2;
+      if(m->segs[mid].first_key <= key) lo = mid;
+      else                               hi = mid - 1;
+   }
+   lm_segment* seg = &m->segs[lo];
+   long seg_end = (lo + 1 < m->num_segs) ? m->segs[lo + 1].start - 1 : m->num_keys - 1;
+
+   // predict the position and clamp it to the segment
+   long pos = seg->start + (long)(seg->slope * (double)(key - seg->first_key));
+   if(pos < seg->start) pos = seg->start;
+   if(pos > seg_end)    pos = seg_end;
+
+   // binary search the error window
+   lo = (pos - LEARNED_ERROR - 1 < 0) ? 0 : pos - LEARNED_ERROR - 1;
+   hi = (pos + LEARNED_ERROR + 1 > m->num_keys - 1) ? m->num_keys - 1 : pos + LEARNED_ERROR + 1;
+   if(m->keys[lo] > key) lo = 0;
+   while(lo < hi) {
+      long mid = (lo + hi + 1) / 2;
+      if(m->keys[mid] <= key) lo = mid;
+      else                    hi = mid - 1;
+   }
+   return m->nodes[lo];
+}
@@ -0,0 +1,37 @@
+/*
+ * Interface for the learned (piecewise-linear) enclave index
+ *
+ * Author: Henry Daly, 2018
+ */
+#ifndef LEARNED_INDEX_H_
+#define LEARNED_INDEX_H_
+
+#include "skiplist.h"
+
+#define LEARNED_ERROR         8     // maximum prediction error (in positions) of a segment
+#define LEARNED_REBUILD_RATIO 8     // rebuild once 1/RATIO of the modeled keys have changed
+#define LEARNED_MIN_REBUILD   64    // ...but never for fewer changes than this
+
+/* a single linear segment: position(key) ~ start + slope * (key - first_key) */
+struct lm_segment {
+   sl_key_t first_key;
+   double   slope;
+   long     start;
+};
+
+/* read-only model over an enclave's intermediate layer keys */
+struct sl_model {
+   size_t        bytes;
+   long          num_keys;
+   long          num_segs;
+   sl_key_t*     keys;
+   node_t**      nodes;
+   lm_segment*   segs;
+};
+
+sl_model*   model_build(mnode_t* head);
+void        model_free(void* model, int unused);
+node_t*     model_lookup(sl_model* model, sl_key_t key);
+long        model_first(sl_model* model, sl_key_t key);
+
+#endif /* LEARNED_INDEX_H_ */
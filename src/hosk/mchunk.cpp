@@ -0,0 +1,282 @@
+/*
+ * mchunk.cpp: chunked (unrolled) copy of the intermediate layer
+ *
+ * Author: Henry Daly, 2018
+ */
+
+/**
+ * Module Overview:
+ *
+ * In chunked mode, the helper thread mirrors its intermediate layer into a linked list
+ * of MCHUNK_SIZE chunks, each holding a sorted run of (key, data layer node) entries.
+ * Every intermediate node records the id of the chunk which currently holds its entry.
+ *
+ * After the index layer descent, the application thread binary searches the chunk of
+ * the intermediate node it reached (continuing into the following chunks while the
+ * search key lies beyond them) instead of hopping node by node along the intermediate
+ * layer. Only the helper writes chunks: each modification is bracketed by two version
+ * increments, and readers retry a chunk whose version was odd or changed while they
+ * read it. Chunks emptied by intermediate node removal are unlinked and retired.
+ *
+ * The level and mark of an intermediate node stay on the node itself: they are only
+ * read by the helper, and keeping them out of the chunks means that raising and
+ * lowering index levels never invalidates concurrent chunk readers.
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include "allocator.h"
+#include "mchunk.h"
+
+mchunk_dir** chunk_dirs;
+extern numa_allocator** allocators;
+
+/* chunk_get() - translate a chunk id */
+static inline sl_mchunk* chunk_get(mchunk_dir* dir, uint id) {
+   return dir->segs[id / MCHUNK_SEG_SIZE][id % MCHUNK_SEG_SIZE];
+}
+
+/* chunk_find() - index of the largest key <= @key in the first @cnt entries (-1 if none) */
+static inline int chunk_find(sl_mchunk* c, int cnt, sl_key_t key) {
+   int lo = 0, hi = cnt - 1;
+   while(lo <= hi) {
+      int mid = (lo + hi) / 2;
+      if(c->keys[mid] <= key) lo = mid + 1;
+      else                    hi = mid - 1;
+   }
+   return hi;
+}
+
+/* write_begin()/write_end() - bracket a helper modification of a published chunk */
+static inline void write_begin(sl_mchunk* c) {
+   c->version++;
+   BARRIER();
+}
+static inline void write_end(sl_mchunk* c) {
+   BARRIER();
+   c->version++;
+}
+
+/* chunk_new() - allocate a chunk and assign it an id */
+static sl_mchunk* chunk_new(mchunk_dir* dir) {
+   uint id;
+   if(dir->num_free > 0) {
+      id = dir->free_ids[--dir->num_free];
+   } else {
+      id = dir->next_id++;
+      assert(id < MCHUNK_DIR_SEGS * MCHUNK_SEG_SIZE);
+      if(dir->segs[id / MCHUNK_SEG_SIZE] == NULL) {
+         sl_mchunk** seg = (sl_mchunk**)calloc(MCHUNK_SEG_SIZE, sizeof(sl_mchunk*));
+         BARRIER();
+         dir->segs[id / MCHUNK_SEG_SIZE] = seg;
+      }
+   }
+   sl_mchunk* c = (sl_mchunk*)allocators[dir->enclave_id]->nalloc(sizeof(sl_mchunk));
+   c->version = 0;
+   c->count   = 0;
+   c->id      = id;
+   c->next    = NULL;
+   BARRIER();
+   dir->segs[id / MCHUNK_SEG_SIZE][id % MCHUNK_SEG_SIZE] = c;
+   return c;
+}
+
+/* mchunk_free() - free a retired chunk and recycle its id */
+static void mchunk_free(void* ptr, int enclave_id) {
+   mchunk_dir* dir = chunk_dirs[enclave_id];
+   sl_mchunk* c = (sl_mchunk*)ptr;
+   if(dir->num_free == dir->cap_free) {
+      dir->cap_free *= 2;
+      dir->free_ids = (uint*)realloc(dir->free_ids, dir->cap_free * sizeof(uint));
+   }
+   dir->free_ids[dir->num_free++] = c->id;
+   allocators[enclave_id]->nfree(c, sizeof(sl_mchunk));
+}
+
+/* mchunk_dir_new() - create the chunk directory of an enclave */
+mchunk_dir* mchunk_dir_new(int enclave_id) {
+   mchunk_dir* dir = (mchunk_dir*)calloc(1, sizeof(mchunk_dir));
+   dir->next_id    = 1;
+   dir->cap_free   = 64;
+   dir->free_ids   = (uint*)malloc(dir->cap_free * sizeof(uint));
+   dir->enclave_id = enclave_id;
+   chunk_dirs[enclave_id] = dir;
+   return dir;
+}
+
+/* mchunk_dir_free() - free the directory (chunk memory belongs to the enclave allocator) */
+void mchunk_dir_free(mchunk_dir* dir) {
+   for(int i = 0; i < MCHUNK_DIR_SEGS; ++i) {
+      if(dir->segs[i]) free(dir->segs[i]);
+   }
+   free(dir->free_ids);
+   free(dir);
+}
+
+/**
+ * mchunk_build() - chunk an existing intermediate layer
+ * @dir  - the enclave's chunk directory
+ * @head - the sentinel intermediate node
+ */
+void mchunk_build(mchunk_dir* dir, mnode_t* head) {
+   sl_mchunk* prev = NULL;
+   mnode_t* mnode = head;
+   while(mnode) {
+      sl_mchunk* c = chunk_new(dir);
+      mnode_t* first = mnode;
+      while(mnode && c->count < MCHUNK_FILL) {
+         c->keys[c->count]  = mnode->key;
+         c->nodes[c->count] = mnode->node;
+         c->count++;
+         mnode = mnode->next;
+      }
+      BARRIER();
+      if(prev) prev->next = c;
+      for(mnode_t* m = first; m != mnode; m = m->next) {
+         m->chunk = c->id;
+      }
+      prev = c;
+   }
+}
+
+/**
+ * mchunk_insert() - add the entry of a newly linked intermediate node
+ * @dir   - the enclave's chunk directory
+ * @prev  - the intermediate node preceding @mnode
+ * @mnode - the new intermediate node
+ */
+void mchunk_insert(mchunk_dir* dir, mnode_t* prev, mnode_t* mnode) {
+   if(prev->chunk == 0) return;
+   sl_mchunk* c = chunk_get(dir, prev->chunk);
+   int pos = chunk_find(c, c->count, prev->key) + 1;
+   int i;
+
+   if(c->count < MCHUNK_ENTRIES) {
+      write_begin(c);
+      for(i = c->count; i > pos; --i) {
+         c->keys[i]  = c->keys[i - 1];
+         c->nodes[i] = c->nodes[i - 1];
+      }
+      c->keys[pos]  = mnode->key;
+      c->nodes[pos] = mnode->node;
+      c->count++;
+      write_end(c);
+      mnode->chunk = c->id;
+      return;
+   }
+
+   /* split: entries from @split onward move to a new chunk, so every moved
+      entry follows @prev and can be re-tagged by walking forward */
+   int split = (pos > MCHUNK_ENTRIES / 2) ? pos : MCHUNK_ENTRIES / 2;
+   sl_mchunk* n = chunk_new(dir);
+   if(split == pos) {
+      n->keys[n->count]  = mnode->key;
+      n->nodes[n->count] = mnode->node;
+      n->count++;
+   }
+   for(i = split; i < c->count; ++i) {
+      n->keys[n->count]  = c->keys[i];
+      n->nodes[n->count] = c->nodes[i];
+      n->count++;
+   }
+   n->next = c->next;
+
+   write_begin(c);
+   c->count = split;
+   if(split != pos) {
+      for(i = c->count; i > pos; --i) {
+         c->keys[i]  = c->keys[i - 1];
+         c->nodes[i] = c->nodes[i - 1];
+      }
+      c->keys[pos]  = mnode->key;
+      c->nodes[pos] = mnode->node;
+      c->count++;
+   }
+   c->next = n;
+   write_end(c);
+
+   mnode->chunk = (split == pos) ? n->id : c->id;
+   sl_key_t first = n->keys[0], last = n->keys[n->count - 1];
+   for(mnode_t* m = mnode->next; m && m->key <= last; m = m->next) {
+      if(m->key >= first) m->chunk = n->id;
+   }
+}
+
+/**
+ * mchunk_remove() - drop the entry of an intermediate node being removed
+ * @dir   - the enclave's chunk directory
+ * @prev  - the intermediate node preceding @mnode
+ * @mnode - the intermediate node being removed
+ * @limbo - where emptied chunks are retired
+ */
+void mchunk_remove(mchunk_dir* dir, mnode_t* prev, mnode_t* mnode, rc_limbo* limbo) {
+   if(mnode->chunk == 0) return;
+   sl_mchunk* c = chunk_get(dir, mnode->chunk);
+   int pos = chunk_find(c, c->count, mnode->key);
+   assert(pos >= 0 && c->keys[pos] == mnode->key);
+
+   if(c->count > 1) {
+      write_begin(c);
+      for(int i = pos; i < c->count - 1; ++i) {
+         c->keys[i]  = c->keys[i + 1];
+         c->nodes[i] = c->nodes[i + 1];
+      }
+      c->count--;
+      write_end(c);
+      return;
+   }
+
+   // the chunk is now empty: unlink it from its predecessor and retire it
+   sl_mchunk* pc = chunk_get(dir, prev->chunk);
+   assert(pc->next == c);
+   write_begin(pc);
+   pc->next = c->next;
+   write_end(pc);
+   rc_retire(limbo, c, mchunk_free, dir->enclave_id);
+}
+
+/**
+ * mchunk_repoint() - update the data layer node of an intermediate node's entry
+ * @dir   - the enclave's chunk directory
+ * @mnode - the intermediate node whose data layer node changed
+ */
+void mchunk_repoint(mchunk_dir* dir, mnode_t* mnode) {
+   if(mnode->chunk == 0) return;
+   sl_mchunk* c = chunk_get(dir, mnode->chunk);
+   int pos = chunk_find(c, c->count, mnode->key);
+   assert(pos >= 0 && c->keys[pos] == mnode->key);
+   write_begin(c);
+   c->nodes[pos] = mnode->node;
+   write_end(c);
+}
+
+/**
+ * mchunk_lookup() - return the data layer node of the largest intermediate key <= @key
+ *  NOTE: returns NULL if @start is not chunked (the caller walks the intermediate layer)
+ * @dir   - the enclave's chunk directory
+ * @start - the intermediate node reached through the index layer
+ * @key   - the search key
+ */
+node_t* mchunk_lookup(mchunk_dir* dir, mnode_t* start, sl_key_t key) {
+   uint id = start->chunk;
+   if(id == 0) return NULL;
+   sl_mchunk* c = chunk_get(dir, id);
+   node_t* best = NULL;
+   while(NULL != c) {
+      uint v = c->version;
+      if(v & 1) continue;
+      BARRIER();
+      int cnt = c->count;
+      if(cnt > MCHUNK_ENTRIES) cnt = MCHUNK_ENTRIES;
+      int i = chunk_find(c, cnt, key);
+      node_t* node = (i >= 0) ? c->nodes[i] : NULL;
+      sl_mchunk* next = c->next;
+      BARRIER();
+      if(c->version != v) continue;
+      if(i < 0) break;
+      best = node;
+      if(i < cnt - 1) break;
+      c = next;
+   }
+   return best;
+}
@@ -0,0 +1,46 @@
+/*
+ * Interface for the chunked (unrolled) intermediate layer
+ *
+ * Author: Henry Daly, 2018
+ */
+#ifndef MCHUNK_H_
+#define MCHUNK_H_
+
+#include "reclaim.h"
+#include "skiplist.h"
+
+#define MCHUNK_SIZE        (4 * CACHE_LINE_SIZE)
+#define MCHUNK_ENTRIES     14    // (MCHUNK_SIZE - header) / (key + node pointer)
+#define MCHUNK_FILL        10    // entries per chunk when built in bulk
+#define MCHUNK_SEG_SIZE    4096  // chunk pointers per directory segment
+#define MCHUNK_DIR_SEGS    65536 // directory segments (ids are 1 .. SEGS * SEG_SIZE - 1, below 2^28)
+
+/* sorted run of intermediate layer entries, written only by the helper thread */
+struct sl_mchunk {
+   volatile uint        version;   // odd while the helper modifies the chunk
+   unsigned short       count;
+   uint                 id;
+   struct sl_mchunk*    next;
+   sl_key_t             keys[MCHUNK_ENTRIES];
+   node_t*              nodes[MCHUNK_ENTRIES];
+};
+
+/* per-enclave id -> chunk directory (segments are never moved, so readers need no lock) */
+struct mchunk_dir {
+   sl_mchunk** volatile segs[MCHUNK_DIR_SEGS];
+   uint                 next_id;
+   uint*                free_ids;
+   int                  num_free;
+   int                  cap_free;
+   int                  enclave_id;
+};
+
+mchunk_dir* mchunk_dir_new(int enclave_id);
+void        mchunk_dir_free(mchunk_dir* dir);
+void        mchunk_build(mchunk_dir* dir, mnode_t* head);
+void        mchunk_insert(mchunk_dir* dir, mnode_t* prev, mnode_t* mnode);
+void        mchunk_remove(mchunk_dir* dir, mnode_t* prev, mnode_t* mnode, rc_limbo* limbo);
+void        mchunk_repoint(mchunk_dir* dir, mnode_t* mnode);
+node_t*     mchunk_lookup(mchunk_dir* dir, mnode_t* start, sl_key_t key);
+
+#endif /* MCHUNK_H_ */
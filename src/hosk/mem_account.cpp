@@ -0,0 +1,146 @@
+/*
+ * mem_account.cpp: memory accounting of the skip list layers
+ *
+ * Author: Henry Daly, 2018
+ */
+
+/**
+ * Module Overview:
+ *
+ * ma_collect() reports where the memory of the skip list goes. The allocators count
+ * their own memory: each data node cache counts its slabs and allocated nodes per NUMA
+ * zone, and each enclave's numa_allocator splits its mapped regions into used, padding,
+ * dead and idle bytes. Walking the layers then tells apart what the allocated objects are:
+ *    - data layer: nodes holding a key, logically deleted nodes, deletion markers and
+ *      nodes being unlinked (allocated data nodes which are not linked at all were
+ *      unlinked and are retired or leaked), and the blocks of the cold segments, which
+ *      are malloc'd outside of the allocators
+ *    - index and intermediate layers: linked nodes and chunks of each enclave (the rest
+ *      of the allocator's used bytes is retired objects waiting for a grace period)
+ *    - opbuffers: their capacity and the operations not yet consumed
+ *
+ * The walks and the counters are only exact while no thread updates the skip list, so
+ * the report is collected once the application and helper threads have stopped.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "cold.h"
+#include "enclave.h"
+#include "mem_account.h"
+#include "mchunk.h"
+
+extern numa_allocator** allocators;
+
+/* ma_count_node() - classify a linked data layer node (other than the sentinel) into @r */
+void ma_count_node(ma_report* r, node_t* node) {
+   val_t val = node->val;
+   if(node->seg && node != val && DL_MOVING != val) {
+      r->segments++;
+      r->live_keys  += ((cold_block*)val)->live;
+      r->cold_bytes += ((cold_block*)val)->bytes;
+   } else if(node == val) {
+      if(0 == node->key) r->markers++;
+      else               r->removed++;
+   } else if(NULL == val) {
+      r->deleted++;
+   } else if(DL_MOVING == val) {
+      r->removed++;
+   } else {
+      r->live++;
+      r->live_keys++;
+   }
+}
+
+/* ma_add_data() - add the data layer counts of @part (e.g. of a slice of the key range) to @r */
+void ma_add_data(ma_report* r, ma_report* part) {
+   r->live_keys  += part->live_keys;
+   r->live       += part->live;
+   r->deleted    += part->deleted;
+   r->markers    += part->markers;
+   r->removed    += part->removed;
+   r->segments   += part->segments;
+   r->cold_bytes += part->cold_bytes;
+}
+
+/* walk_data() - classify the linked data layer nodes */
+static void walk_data(ma_report* r, node_t* head) {
+   r->markers++;   // the sentinel
+   for(node_t* node = head->next; NULL != node; node = node->next) ma_count_node(r, node);
+}
+
+/* walk_enclave() - count the linked index and intermediate nodes of @obj */
+static void walk_enclave(ma_enclave* e, enclave* obj) {
+   inode_t* sentinel = obj->get_sentinel();
+   for(inode_t* level = sentinel; NULL != level; level = level->down) {
+      for(inode_t* inode = level; NULL != inode; inode = inode->right) e->inodes++;
+   }
+   for(mnode_t* mnode = sentinel->intermed; NULL != mnode; mnode = mnode->next) e->mnodes++;
+   if(NULL != obj->chunks) {
+      e->chunks = obj->chunks->next_id - 1 - obj->chunks->num_free;
+   }
+   if(NULL != obj->model) e->model = obj->model->bytes;
+}
+
+/**
+ * ma_collect() - account the memory of the skip list (no thread may update it meanwhile)
+ * @enclaves     - all enclaves
+ * @num_enclaves - the number of enclaves
+ * @head         - the data layer sentinel (NULL: the caller counts the data layer nodes,
+ *                  e.g. in parallel with bl_validate())
+ * @main_cache   - the data node cache of the main thread (which allocated the sentinel)
+ */
+ma_report* ma_collect(enclave** enclaves, int num_enclaves, node_t* head, np_cache* main_cache) {
+   ma_report* r = (ma_report*)calloc(1, sizeof(ma_report));
+   r->num_enclaves = num_enclaves;
+   r->enclaves = (ma_enclave*)calloc(num_enclaves, sizeof(ma_enclave));
+   if(NULL != head) walk_data(r, head);
+   if(NULL != main_cache) np_usage_add(main_cache, &r->pool);
+   for(int i = 0; i < num_enclaves; ++i) {
+      ma_enclave* e = &r->enclaves[i];
+      np_usage_add(node_pools[i], &r->pool);
+      np_usage_add(helper_pools[i], &r->pool);
+      e->zone = enclaves[i]->get_socket_num();
+      walk_enclave(e, enclaves[i]);
+      allocators[i]->usage(&e->alloc);
+      enclaves[i]->opbuffer_usage(&e->op_capacity, &e->op_pending);
+   }
+   return r;
+}
+
+/* ma_free() - free a report */
+void ma_free(ma_report* r) {
+   free(r->enclaves);
+   free(r);
+}
+
+/* ma_data_bytes() - bytes of the allocated data nodes on @zone */
+unsigned long ma_data_bytes(ma_report* r, int zone) {
+   return r->pool.nodes[zone] * sizeof(sl_node);
+}
+
+/* ma_reserved() - bytes mapped for the data nodes, cold blocks, allocators, learned models and opbuffers */
+unsigned long ma_reserved(ma_report* r) {
+   unsigned long bytes = r->cold_bytes;
+   for(int zone = 0; zone < NP_MAX_ZONES; ++zone) {
+      bytes += r->pool.slabs[zone] * NP_SLAB_SIZE;
+   }
+   for(int i = 0; i < r->num_enclaves; ++i) {
+      ma_enclave* e = &r->enclaves[i];
+      bytes += e->alloc.reserved + e->model + e->op_capacity;
+   }
+   return bytes;
+}
+
+/* ma_used() - bytes of the allocated data nodes, cold blocks, allocator objects, learned models and pending operations */
+unsigned long ma_used(ma_report* r) {
+   unsigned long bytes = r->cold_bytes;
+   for(int zone = 0; zone < NP_MAX_ZONES; ++zone) {
+      bytes += ma_data_bytes(r, zone);
+   }
+   for(int i = 0; i < r->num_enclaves; ++i) {
+      ma_enclave* e = &r->enclaves[i];
+      bytes += e->alloc.used + e->model + e->op_pending;
+   }
+   return bytes;
+}
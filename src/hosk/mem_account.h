@@ -0,0 +1,49 @@
+/*
+ * Interface for the memory accounting of the skip list layers
+ *
+ * Author: Henry Daly, 2018
+ */
+#ifndef MEM_ACCOUNT_H_
+#define MEM_ACCOUNT_H_
+
+#include "allocator.h"
+#include "node_pool.h"
+#include "skiplist.h"
+
+class enclave;
+
+/* ma_enclave is the memory of an enclave's index and intermediate layers and opbuffer */
+struct ma_enclave {
+   int            zone;          // NUMA zone (socket) of the enclave's allocator
+   unsigned long  inodes;        // linked index nodes
+   unsigned long  mnodes;        // linked intermediate nodes
+   unsigned long  chunks;        // intermediate chunks (retired ones included)
+   unsigned long  model;         // bytes of the published learned model
+   na_usage       alloc;         // the enclave's allocator
+   unsigned long  op_capacity;   // bytes of the opbuffer
+   unsigned long  op_pending;    // opbuffer bytes of operations not consumed yet
+};
+
+/* ma_report is the memory of the whole skip list */
+struct ma_report {
+   long           live_keys;     // keys in the set (cold segment keys included)
+   unsigned long  live;          // linked data layer nodes holding a key
+   unsigned long  deleted;       // linked nodes of logically deleted keys
+   unsigned long  markers;       // linked deletion markers and the sentinel
+   unsigned long  removed;       // linked nodes being unlinked or relocated
+   unsigned long  segments;      // linked cold segment nodes
+   unsigned long  cold_bytes;    // blocks of the linked cold segments (malloc'd)
+   np_usage       pool;          // data node slabs and allocated nodes, by zone
+   int            num_enclaves;
+   ma_enclave*    enclaves;
+};
+
+ma_report*     ma_collect(enclave** enclaves, int num_enclaves, node_t* head, np_cache* main_cache);
+void           ma_free(ma_report* r);
+void           ma_count_node(ma_report* r, node_t* node);
+void           ma_add_data(ma_report* r, ma_report* part);
+unsigned long  ma_data_bytes(ma_report* r, int zone);
+unsigned long  ma_reserved(ma_report* r);
+unsigned long  ma_used(ma_report* r);
+
+#endif /* MEM_ACCOUNT_H_ */
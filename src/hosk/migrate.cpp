@@ -0,0 +1,360 @@
+/*
+ * migrate.cpp: relocation of data layer nodes (hot node migration and key order compaction)
+ *
+ * Author: Henry Daly, 2018
+ */
+
+/**
+ * Module Overview:
+ *
+ * Every MIG_SAMPLE_PERIOD operations, an application thread whose operation ended on a
+ * data layer node of a foreign NUMA zone records the key in its enclave's sample ring.
+ * The helper thread counts the samples per key (a small direct-mapped table, periodically
+ * decayed so that a shifting hotspot is followed) and moves a key's node to its own zone
+ * once it has seen MIG_THRESHOLD samples of it.
+ *
+ * A node N is moved by replacing it in the data layer:
+ *    1. a copy C, with the value DL_MOVING, is linked right after N. Searches for the key
+ *       now end on C, and operations which find DL_MOVING act on N (C->prev) instead.
+ *    2. N is frozen by swinging its value to N (the removal state). From here on C is the
+ *       only node of the key: operations which find N retry from its predecessor.
+ *    3. the frozen value is transferred to C, and N is unlinked as any removed node.
+ * Only the instructions between 2 and 3 make operations on the key wait. Steps 1 and 2
+ * are serialized by a global try-lock, so two helpers never replace the same node.
+ *
+ * N may still be referenced by operations in flight (which may publish it through their
+ * opbuffer), by the intermediate layers of any enclave which saw an operation on it, and
+ * by the chunks and learned models built from those. N is therefore freed only after three
+ * grace periods: by the end of the first, every operation which found N has published it;
+ * by the end of the second, every helper has drained those publications and processed the
+ * repoint request sent with the migration; after the third, no reader holds a reference
+ * it obtained before the repoint.
+ *
+ * Compaction reuses the same replacement to restore scan locality after churn. Each
+ * enclave owns a slice of the key range; every compaction period its helper walks the
+ * slice in key order (COMPACT_BATCH nodes per helper iteration) and copies each run of
+ * keys which is scattered in memory into consecutive slots of a fresh slab. A slice which
+ * is already compact is walked without being copied. The same slices are turned into cold
+ * segments when they stop being updated (see cold.cpp).
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <time.h>
+#include "enclave.h"
+#include "migrate.h"
+#include "node_pool.h"
+
+mig_state** mig_states;
+static int num_states = 0;
+static volatile AO_t mig_lock = 0;
+
+/* mig_init()/mig_fini() - create and free the table of enclave migration states */
+void mig_init(int num_enclaves) {
+   num_states = num_enclaves;
+   mig_states = (mig_state**)calloc(num_enclaves, sizeof(mig_state*));
+}
+void mig_fini(void) {
+   free(mig_states);
+}
+
+/* mig_num_states() - number of enclave migration states */
+int mig_num_states(void) {
+   return num_states;
+}
+
+/* mig_new() - create the migration state of an enclave */
+mig_state* mig_new(int enclave_id) {
+   mig_state* mig = (mig_state*)calloc(1, sizeof(mig_state));
+   mig_states[enclave_id] = mig;
+   return mig;
+}
+
+/* mig_free() - free the migration state (pending requests included) */
+void mig_free(mig_state* mig) {
+   mig_req* req = (mig_req*)mig->requests;
+   while(req != NULL) {
+      mig_req* next = req->next;
+      free(req);
+      req = next;
+   }
+   free(mig);
+}
+
+/* dl_node_free() - free an unlinked data layer node and the marker which unlinked it */
+void dl_node_free(void* ptr, int unused) {
+   node_t* node = (node_t*)ptr;
+   node_t* marker = node->next;
+   if(marker != NULL && marker->key == 0 && marker->val == marker && marker->prev == node) {
+      node_delete(marker);
+   }
+   node_delete(node);
+}
+
+/* mig_trylock()/mig_unlock() - serialize the relocation of data layer nodes */
+bool mig_trylock(void) {
+   return CAS(&mig_lock, 0, 1);
+}
+void mig_unlock(void) {
+   AO_store_full(&mig_lock, 0);
+}
+
+/* mig_request_repoint() - ask every helper to repoint its references to the nodes of keys [@lo, @hi] */
+void mig_request_repoint(sl_key_t lo, sl_key_t hi) {
+   for(int i = 0; i < num_states; ++i) {
+      mig_state* mig = mig_states[i];
+      if(mig == NULL) continue;
+      mig_req* req = (mig_req*)malloc(sizeof(mig_req));
+      req->lo = lo;
+      req->hi = hi;
+      do {
+         req->next = (mig_req*)mig->requests;
+      } while(!CAS(&mig->requests, req->next, req));
+   }
+}
+
+/**
+ * replace_node() - replace a live data layer node by @copy
+ * @obj  - the enclave object
+ * @node - the node to replace
+ * @copy - the uninitialized replacement (freed if the node cannot be replaced)
+ * returns 1 if the node was replaced, 0 otherwise
+ */
+static int replace_node(enclave* obj, node_t* node, node_t* copy) {
+   if(!mig_trylock()) {
+      node_delete(copy);
+      return 0;
+   }
+   // checked under the lock: a frozen node is never replaced twice
+   val_t val = node->val;
+   node_t* next = node->next;
+   bool linked = false;
+   if(node->prev != NULL && !node->seg && val != NULL && val != node && val != DL_MOVING &&
+      (next == NULL || (next->val != next && next->val != DL_MOVING))) {
+      copy->key   = node->key;
+      copy->val   = DL_MOVING;
+      copy->prev  = node;
+      copy->next  = next;
+      copy->level = node->level;
+      copy->seg   = false;
+      linked = CAS(&node->next, next, copy);
+   }
+   if(!linked) {
+      mig_unlock();
+      node_delete(copy);
+      return 0;
+   }
+   if(NULL != next) { next->prev = copy; }
+
+   // freeze the original and transfer its value
+   do {
+      val = node->val;
+   } while(!CAS(&node->val, val, node));
+   copy->val = val;
+   AO_nop_full();
+   mig_unlock();
+
+   dl_unlink(node);
+   mig_request_repoint(node->key, node->key);
+   rc_retire_staged(obj->limbo, (void*)node, dl_node_free, 0, MIG_GRACE_PERIODS);
+   return 1;
+}
+
+/**
+ * migrate_node() - replace the data layer node of @key by a copy on the helper's zone
+ * @obj - the enclave object
+ * @key - the hot key
+ * returns 1 if the node was moved, 0 otherwise
+ */
+static int migrate_node(enclave* obj, sl_key_t key) {
+   node_t* node = bg_find_node(obj, key);
+   if(node == NULL || np_node_zone((void*)node) == helper_pools[obj->get_enclave_num()]->home_zone) {
+      return 0;
+   }
+   return replace_node(obj, node, (node_t*)np_alloc_local());
+}
+
+/* counter_of() - the hot key counter slot of @key */
+static inline mig_counter* counter_of(mig_state* mig, sl_key_t key) {
+   return &mig->hot[(key * 0x9E3779B97F4A7C15UL) >> 54 & (MIG_TABLE - 1)];
+}
+
+/**
+ * mig_process() - count the sampled keys and move the nodes of hot keys
+ * @obj - the enclave object
+ */
+void mig_process(enclave* obj) {
+   mig_state* mig = obj->mig;
+   unsigned head = mig->head;
+   BARRIER();
+   if(head - mig->tail > MIG_RING) {
+      mig->tail = head - MIG_RING;   // samples were overwritten
+   }
+   while(mig->tail != head) {
+      sl_key_t key = mig->samples[mig->tail % MIG_RING];
+      mig->tail++;
+
+      mig_counter* c = counter_of(mig, key);
+      if(c->key != key) {
+         if(c->count > 0) {
+            c->count--;
+            continue;
+         }
+         c->key = key;
+      }
+      if(++c->count >= MIG_THRESHOLD) {
+         c->count = 0;
+         mig->migrations += migrate_node(obj, key);
+      }
+      if(++mig->since_decay >= MIG_DECAY) {
+         mig->since_decay = 0;
+         for(int i = 0; i < MIG_TABLE; ++i) {
+            mig->hot[i].count /= 2;
+         }
+      }
+   }
+}
+
+/* repoint_entry() - the node which now holds @key in place of the removed @node, NULL if
+   @key was unlinked */
+static node_t* repoint_entry(node_t* node, sl_key_t key) {
+   // dl_entry() is NULL only while a cold segment is being built
+   node_t* live;
+   while(NULL == (live = dl_entry(node, key))) {}
+   if(live->key == key || (live->seg && key <= ((cold_block*)live->val)->last)) return live;
+   return NULL;
+}
+
+/**
+ * mig_repoint() - repoint the intermediate layer (and chunk and model entries) of every
+ *  key range whose data layer nodes were moved
+ * @obj - the enclave object
+ */
+void mig_repoint(enclave* obj) {
+   mig_state* mig = obj->mig;
+   if(mig->requests == 0) return;
+   mig_req* req;
+   do {
+      req = (mig_req*)mig->requests;
+   } while(!CAS(&mig->requests, req, NULL));
+
+   while(req != NULL) {
+      mig_req* next = req->next;
+      // an entry whose key was unlinked takes the entry before it (keys start at 1)
+      mnode_t* prev = bg_find_mnode(obj, req->lo - 1);
+      for(mnode_t* mnode = prev->next; NULL != mnode && mnode->key <= req->hi; mnode = mnode->next) {
+         node_t* node = mnode->node;
+         if(node->val == node) {
+            node_t* live = repoint_entry(node, mnode->key);
+            mnode->node = (NULL != live) ? live : prev->node;
+            if(obj->chunks) mchunk_repoint(obj->chunks, mnode);
+            bg_share_node(obj, mnode, node, mnode->node);
+         }
+         prev = mnode;
+      }
+      sl_model* model = obj->model;
+      if(NULL != model) {
+         for(long i = model_first(model, req->lo); i < model->num_keys && model->keys[i] <= req->hi; ++i) {
+            node_t* node = model->nodes[i];
+            if(node->val != node) continue;
+            node_t* live = repoint_entry(node, model->keys[i]);
+            model->nodes[i] = (NULL != live) ? live : model->nodes[i - 1];
+            for(long j = i + 1; j < model->num_keys && model->nodes[j] == node; ++j) {
+               model->nodes[j] = model->nodes[i];
+            }
+         }
+      }
+      free(req);
+      req = next;
+   }
+}
+
+/**
+ * mig_set_slice() - assign an enclave its slice of the key range (compaction and cold segments)
+ * @mig        - the enclave's migration state
+ * @lo         - first key of the slice
+ * @hi         - first key past the slice
+ * @compact_ms - milliseconds between the starts of two compaction passes (0 = never)
+ */
+void mig_set_slice(mig_state* mig, sl_key_t lo, sl_key_t hi, long compact_ms) {
+   mig->slice_lo   = lo;
+   mig->slice_hi   = hi;
+   mig->cmp_next   = hi;   // no pass in progress
+   mig->cmp_period = compact_ms;
+}
+
+/* now_ms() - coarse monotonic clock */
+static inline long now_ms(void) {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+   return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * collect_run() - gather up to COMPACT_RUN live nodes of keys in [@from, @hi), in key order
+ * @obj  - the enclave object
+ * @from - the first key
+ * @hi   - the first key past the slice
+ * @run  - filled with the nodes
+ * returns the number of nodes gathered
+ */
+static int collect_run(enclave* obj, sl_key_t from, sl_key_t hi, node_t** run) {
+   node_t *node = bg_find_mnode(obj, from)->node, *next;
+   val_t val;
+   int n = 0;
+   while(n < COMPACT_RUN) {
+      while(node == node->val) node = node->prev;
+      next = node->next;
+      if(NULL != next && next->val == next) {
+         node_remove(node, next);
+         continue;
+      }
+      val = node->val;
+      if(node->key >= from && node->key < hi && NULL != val && DL_MOVING != val && !node->seg) {
+         run[n++] = node;
+         from = node->key + 1;
+      }
+      if(NULL == next || next->key >= hi) break;
+      node = next;
+   }
+   return n;
+}
+
+/**
+ * mig_compact() - run the next batch of the enclave's compaction pass
+ * @obj - the enclave object
+ *
+ * The slice is processed in runs of COMPACT_RUN live nodes. A run is copied into adjacent
+ * fresh nodes once more than a quarter of its nodes are not within COMPACT_GAP nodes
+ * after their predecessor in memory.
+ */
+void mig_compact(enclave* obj) {
+   mig_state* mig = obj->mig;
+   if(mig->cmp_next >= mig->slice_hi) {
+      if(mig->cmp_period == 0) return;
+      long now = now_ms();
+      if(now - mig->cmp_start < mig->cmp_period) return;
+      mig->cmp_start = now;
+      mig->cmp_next  = mig->slice_lo;
+   }
+
+   node_t* run[COMPACT_RUN];
+   for(int batch = 0; batch < COMPACT_BATCH; batch += COMPACT_RUN) {
+      int n = collect_run(obj, mig->cmp_next, mig->slice_hi, run);
+      int breaks = 0;
+      for(int i = 1; i < n; ++i) {
+         long gap = run[i] - run[i - 1];
+         if(gap <= 0 || gap > COMPACT_GAP) breaks++;
+      }
+      if(breaks * 4 > n) {
+         for(int i = 0; i < n; ++i) {
+            mig->compacted += replace_node(obj, run[i], (node_t*)np_alloc_fresh(run[i]->key));
+         }
+      }
+      if(n < COMPACT_RUN) {
+         mig->cmp_next = mig->slice_hi;   // pass complete
+         return;
+      }
+      mig->cmp_next = run[n - 1]->key + 1;
+   }
+}
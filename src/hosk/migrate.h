@@ -0,0 +1,84 @@
+/*
+ * Interface for the migration of hot data layer nodes
+ *
+ * Author: Henry Daly, 2018
+ */
+#ifndef MIGRATE_H_
+#define MIGRATE_H_
+
+#include "common.h"
+#include "skiplist.h"
+#include "cold.h"
+
+#define MIG_SAMPLE_PERIOD  64     // application operations between two samples
+#define MIG_RING           256    // sampled keys buffered for the helper thread
+#define MIG_TABLE          1024   // hot key counters per enclave
+#define MIG_THRESHOLD      8      // remote samples which make a key hot
+#define MIG_DECAY          4096   // samples between two halvings of every counter
+#define MIG_GRACE_PERIODS  3      // publish, repoint and read grace periods of a moved node
+#define COMPACT_BATCH      256    // live nodes walked by a helper iteration of a compaction pass
+#define COMPACT_RUN        64     // live nodes copied together by compaction
+#define COMPACT_GAP        8      // nodes between two keys which are still considered adjacent
+#define SWEEP_HOPS         128    // data layer nodes walked by the sweep of one intermediate node's gap
+
+class enclave;
+
+/* mig_counter counts the remote samples of a key */
+struct mig_counter {
+   sl_key_t    key;
+   unsigned    count;
+};
+
+/* mig_req asks a helper to repoint its references to the moved nodes of a key range */
+struct mig_req {
+   sl_key_t    lo;
+   sl_key_t    hi;
+   mig_req*    next;
+};
+
+/* mig_state is the per-enclave migration state */
+struct mig_state {
+   sl_key_t          samples[MIG_RING];   // keys of remote nodes, written by the application thread
+   volatile unsigned head;
+   unsigned          tick;                // application operations since the last sample
+   unsigned long     sampled;             // operations sampled
+   unsigned long     remote;              // sampled operations which ended on a remote node
+   CACHE_PAD(0);
+   unsigned          tail;                // first sample not yet counted by the helper thread
+   unsigned          since_decay;
+   unsigned long     migrations;          // nodes moved by this enclave
+   mig_counter       hot[MIG_TABLE];
+   sl_key_t          slice_lo;            // slice [slice_lo, slice_hi) of the key range kept by this enclave
+   sl_key_t          slice_hi;
+   sl_key_t          cmp_next;            // first key of the next compaction batch (slice_hi between passes)
+   long              cmp_period;
+   long              cmp_start;           // start time of the last pass (ms)
+   unsigned long     compacted;           // nodes copied by compaction
+   unsigned long     swept;               // deleted nodes unlinked by the helper thread
+   unsigned          cold_updates[COLD_BUCKETS];  // updates published per bucket, read by every helper
+   unsigned          cold_seen[COLD_BUCKETS];     // sums of all enclaves' counters at the last round
+   unsigned char     cold_quiet[COLD_BUCKETS];    // rounds without an update in the bucket
+   long              cold_round;          // start time of the last cold round (ms)
+   cold_stats        cold;
+   CACHE_PAD(1);
+   volatile AO_t     requests;            // mig_req stack, pushed by any helper thread
+   volatile AO_t     thawed;              // stack of the split cold_blocks this enclave built, pushed by any application thread
+};
+
+extern mig_state** mig_states;
+
+void        mig_init(int num_enclaves);
+int         mig_num_states(void);
+void        mig_fini(void);
+mig_state*  mig_new(int enclave_id);
+void        mig_free(mig_state* mig);
+void        mig_process(enclave* obj);
+void        mig_repoint(enclave* obj);
+void        mig_set_slice(mig_state* mig, sl_key_t lo, sl_key_t hi, long compact_ms);
+void        mig_compact(enclave* obj);
+bool        mig_trylock(void);
+void        mig_unlock(void);
+void        mig_request_repoint(sl_key_t lo, sl_key_t hi);
+void        dl_node_free(void* node, int unused);
+
+#endif /* MIGRATE_H_ */
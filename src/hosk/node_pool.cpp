@@ -0,0 +1,232 @@
+/*
+ * node_pool.cpp: NUMA-aware data layer node pools
+ *
+ * Author: Henry Daly, 2018
+ */
+
+/**
+ * Module Overview:
+ *
+ * Data layer nodes are carved out of NP_SLAB_SIZE slabs, each bound (mbind) to a single
+ * NUMA zone. Every enclave owns one np_cache per thread (the application thread creates
+ * the data layer nodes, the helper thread their migrated copies), with a free list and a
+ * current slab per zone.
+ * The placement policy picks the zone of each new node:
+ *    - local:      the zone of the inserting thread
+ *    - interleave: zones in round-robin order
+ *    - range:      the home zone of the key, with the key range split evenly
+ *
+ * Slabs are aligned to their size, so a node's slab header (owner and zone) is found by
+ * masking its address. A node freed by its owner goes straight onto the owner's free list
+ * for that zone; a node freed by any other thread is pushed onto the owner's remote free
+ * stack, which the owner drains once a zone runs out of free nodes. Slabs themselves are
+ * never returned to the OS. Each zone of a cache counts its slabs and its allocated nodes
+ * (those freed by other threads count until the owner drains them) for memory accounting.
+ */
+
+#include <assert.h>
+#include <numa.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "node_pool.h"
+#include "virtual_numa.h"
+
+np_cache** node_pools;
+np_cache** helper_pools;
+
+static __thread np_cache* np_local = NULL;
+static int  np_placement = NP_LOCAL;
+static long np_range = 1;
+static int  np_num_zones = 1;
+
+/* np_set_policy() - select the placement policy (before any node is created) */
+void np_set_policy(int policy, long range, int zones) {
+   np_placement = policy;
+   np_range     = range;
+   np_num_zones = (zones > NP_MAX_ZONES) ? NP_MAX_ZONES : zones;
+}
+
+/* np_policy_name() - printable name of a placement policy */
+const char* np_policy_name(int policy) {
+   switch(policy) {
+      case NP_INTERLEAVE:  return "interleave";
+      case NP_RANGE:       return "key range";
+      default:             return "local";
+   }
+}
+
+/* np_cache_new() - create the data node cache of a thread running on @home_zone */
+np_cache* np_cache_new(int home_zone) {
+   np_cache* cache = (np_cache*)ALIGNED_ALLOC(sizeof(np_cache));
+   memset(cache, 0, sizeof(np_cache));
+   cache->home_zone = home_zone % np_num_zones;
+   cache->next_zone = cache->home_zone;
+   return cache;
+}
+
+/* np_thread_init() - make @cache the data node cache of the calling thread */
+void np_thread_init(np_cache* cache) {
+   np_local = cache;
+}
+
+/* np_node_zone() - NUMA zone of the slab holding @node */
+int np_node_zone(void* node) {
+   return ((np_slab*)((unsigned long)node & ~((unsigned long)NP_SLAB_SIZE - 1)))->zone;
+}
+
+/* slab_new() - map a slab bound to @zone */
+static np_slab* slab_new(np_cache* cache, int zone) {
+   size_t len = 2 * NP_SLAB_SIZE;
+   char* raw = (char*)mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+   if(raw == MAP_FAILED) {
+      perror("mmap");
+      exit(-1);
+   }
+   char* slab = (char*)(((unsigned long)raw + NP_SLAB_SIZE - 1) & ~((unsigned long)NP_SLAB_SIZE - 1));
+   if(slab != raw) munmap(raw, slab - raw);
+   munmap(slab + NP_SLAB_SIZE, (raw + len) - (slab + NP_SLAB_SIZE));
+   numa_tonode_memory(slab, NP_SLAB_SIZE, vn_node(zone));
+
+   np_slab* s = (np_slab*)slab;
+   s->owner = cache;
+   s->zone  = zone;
+   cache->zones[zone].slabs++;
+   return s;
+}
+
+/* drain_remote() - move nodes freed by other threads onto their zone free lists */
+static void drain_remote(np_cache* cache) {
+   void* head;
+   do {
+      head = (void*)cache->remote_free;
+   } while(head != NULL && !CAS(&cache->remote_free, head, NULL));
+
+   while(head != NULL) {
+      void* next = *(void**)head;
+      np_slab* s = (np_slab*)((unsigned long)head & ~((unsigned long)NP_SLAB_SIZE - 1));
+      np_zone* z = &cache->zones[s->zone];
+      *(void**)head = z->free_list;
+      z->free_list = head;
+      z->nodes--;
+      head = next;
+   }
+}
+
+/* pick_zone() - NUMA zone of a new node for @key */
+static inline int pick_zone(np_cache* cache, sl_key_t key) {
+   switch(np_placement) {
+      case NP_INTERLEAVE:
+         return cache->next_zone++ % np_num_zones;
+      case NP_RANGE: {
+         long zone = (long)(((double)key / (np_range + 1)) * np_num_zones);
+         return (zone >= np_num_zones) ? np_num_zones - 1 : (int)zone;
+      }
+      default:
+         return cache->home_zone;
+   }
+}
+
+/* alloc_on() - allocate a data layer node on @zone from @cache (from the current slab if @fresh) */
+static void* alloc_on(np_cache* cache, int zone, bool fresh) {
+   np_zone* z = &cache->zones[zone];
+
+   if(fresh) {
+      if(z->bump + sizeof(sl_node) > z->end) {
+         char* slab = (char*)slab_new(cache, zone);
+         z->bump = slab + NP_SLAB_HEADER;
+         z->end  = slab + NP_SLAB_SIZE;
+      }
+      void* node = z->bump;
+      z->bump += sizeof(sl_node);
+      z->nodes++;
+      return node;
+   }
+   if(z->free_list == NULL && z->bump + sizeof(sl_node) > z->end) {
+      if(cache->remote_free != 0) {
+         drain_remote(cache);
+      }
+      if(z->free_list == NULL) {
+         char* slab = (char*)slab_new(cache, zone);
+         z->bump = slab + NP_SLAB_HEADER;
+         z->end  = slab + NP_SLAB_SIZE;
+      }
+   }
+   void* node;
+   if(z->free_list != NULL) {
+      node = z->free_list;
+      z->free_list = *(void**)node;
+   } else {
+      node = z->bump;
+      z->bump += sizeof(sl_node);
+   }
+   z->nodes++;
+   return node;
+}
+
+/**
+ * np_alloc() - allocate a data layer node from the calling thread's cache
+ * @key - key of the new node (used by the key range policy)
+ */
+void* np_alloc(sl_key_t key) {
+   np_cache* cache = np_local;
+   assert(NULL != cache);
+   return alloc_on(cache, pick_zone(cache, key), false);
+}
+
+/* np_alloc_local() - allocate a data layer node on the calling thread's zone, whatever the policy */
+void* np_alloc_local(void) {
+   np_cache* cache = np_local;
+   assert(NULL != cache);
+   return alloc_on(cache, cache->home_zone, false);
+}
+
+/**
+ * np_alloc_fresh() - allocate a data layer node never taken from a free list, so that
+ *  consecutive calls return adjacent nodes (except across slabs)
+ * @key - key of the new node (placed on its home zone by the key range policy, on the
+ *        calling thread's zone otherwise)
+ */
+void* np_alloc_fresh(sl_key_t key) {
+   np_cache* cache = np_local;
+   assert(NULL != cache);
+   int zone = (np_placement == NP_RANGE) ? pick_zone(cache, key) : cache->home_zone;
+   return alloc_on(cache, zone, true);
+}
+
+/**
+ * np_free() - return a data layer node to the cache which owns its slab
+ * @node - the node (no thread may still reference it)
+ */
+void np_free(void* node) {
+   np_slab* s = (np_slab*)((unsigned long)node & ~((unsigned long)NP_SLAB_SIZE - 1));
+   np_cache* owner = s->owner;
+   if(owner == np_local) {
+      np_zone* z = &owner->zones[s->zone];
+      *(void**)node = z->free_list;
+      z->free_list = node;
+      z->nodes--;
+   } else {
+      void* head;
+      do {
+         head = (void*)owner->remote_free;
+         *(void**)node = head;
+      } while(!CAS(&owner->remote_free, head, node));
+   }
+}
+
+/**
+ * np_usage_add() - add the slabs and allocated nodes of @cache to @u
+ * @cache - the cache (its owner and the threads freeing into it must be quiescent)
+ * @u     - the accumulated usage
+ */
+void np_usage_add(np_cache* cache, np_usage* u) {
+   for(int zone = 0; zone < NP_MAX_ZONES; ++zone) {
+      u->slabs[zone] += cache->zones[zone].slabs;
+      u->nodes[zone] += cache->zones[zone].nodes;
+   }
+   // nodes freed by other threads and not yet drained are not allocated
+   for(void* node = (void*)cache->remote_free; node != NULL; node = *(void**)node) {
+      u->nodes[np_node_zone(node)]--;
+   }
+}
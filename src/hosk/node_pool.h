@@ -0,0 +1,68 @@
+/*
+ * Interface for the NUMA-aware data layer node pools
+ *
+ * Author: Henry Daly, 2018
+ */
+#ifndef NODE_POOL_H_
+#define NODE_POOL_H_
+
+#include "common.h"
+#include "skiplist.h"
+
+#define NP_SLAB_SIZE    (1024 * 1024)  // data node slabs are aligned to their size (header found by masking)
+#define NP_SLAB_HEADER  CACHE_LINE_SIZE
+#define NP_MAX_ZONES    64
+
+/* data layer node placement policies */
+enum np_policy {
+   NP_LOCAL,         // on the NUMA zone of the inserting thread
+   NP_INTERLEAVE,    // round-robin across NUMA zones
+   NP_RANGE          // on the home zone of the key (the key range is split evenly across zones)
+};
+
+/* np_zone is a per-zone free list and bump region, used by a single owner */
+struct np_zone {
+   void*          free_list;     // freed nodes (the first word links to the next)
+   char*          bump;          // first never allocated node of the current slab
+   char*          end;           // end of the current slab
+   unsigned long  slabs;         // slabs mapped for this zone
+   unsigned long  nodes;         // allocated nodes not returned to this cache
+};
+
+/* np_cache is the data node cache of one owning thread (an enclave's application or helper thread) */
+struct np_cache {
+   int            home_zone;     // NUMA zone of the owner
+   unsigned       next_zone;     // interleaving cursor
+   np_zone        zones[NP_MAX_ZONES];
+   CACHE_PAD(0);
+   volatile AO_t  remote_free;   // nodes freed by other threads (lock-free stack)
+   CACHE_PAD(1);
+};
+
+/* np_usage is the data node memory of a set of caches, by NUMA zone */
+struct np_usage {
+   unsigned long  slabs[NP_MAX_ZONES];   // mapped slabs
+   unsigned long  nodes[NP_MAX_ZONES];   // allocated nodes (freed nodes excluded)
+};
+
+/* np_slab is the header of a data node slab */
+struct np_slab {
+   np_cache*      owner;         // cache which allocates from (and recycles into) this slab
+   int            zone;          // NUMA zone the slab is bound to
+};
+
+extern np_cache** node_pools;     // per enclave, used by the application thread
+extern np_cache** helper_pools;   // per enclave, used by the helper thread
+
+void        np_set_policy(int policy, long range, int zones);
+const char* np_policy_name(int policy);
+np_cache*   np_cache_new(int home_zone);
+void        np_thread_init(np_cache* cache);
+void*       np_alloc(sl_key_t key);
+void*       np_alloc_local(void);
+void*       np_alloc_fresh(sl_key_t key);
+void        np_free(void* node);
+int         np_node_zone(void* node);
+void        np_usage_add(np_cache* cache, np_usage* u);
+
+#endif /* NODE_POOL_H_ */
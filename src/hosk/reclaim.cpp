@@ -0,0 +1,169 @@
+/*
+ * reclaim.cpp: epoch-based memory reclamation
+ *
+ * Author: Henry Daly, 2018
+ */
+
+/**
+ * Module Overview:
+ *
+ * Objects which may still be referenced by concurrent readers (e.g. a replaced
+ * learned model) cannot be freed immediately. Instead, the context which unlinks
+ * them retires them into its limbo list, stamped with the global epoch. Every
+ * participant announces the global epoch at its quiescent points (an application
+ * thread between operations, a helper thread between loop iterations). The global
+ * epoch only advances once every online participant has announced it, so an object
+ * retired at epoch e can be freed once the global epoch reaches e + RC_GRACE.
+ *
+ * Some objects need several consecutive grace periods (e.g. an unlinked data layer node:
+ * one for operations which may still publish it, one for the helpers to drop their
+ * references to it, and one for readers of those references). A staged entry is simply
+ * re-stamped and moved to the back of the limbo list after each of its grace periods.
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "reclaim.h"
+
+static volatile unsigned long global_epoch = 0;
+static rc_record records[RC_MAX_RECORDS];
+
+/* rc_register() - claim an announcement record (initially offline) */
+rc_record* rc_register(void) {
+   for(int i = 0; i < RC_MAX_RECORDS; ++i) {
+      if(!records[i].used && CAS(&records[i].used, 0, 1)) {
+         records[i].online = false;
+         records[i].epoch = global_epoch;
+         return &records[i];
+      }
+   }
+   assert(false);
+   return NULL;
+}
+
+/* rc_unregister() - release an announcement record */
+void rc_unregister(rc_record* rec) {
+   rec->online = false;
+   BARRIER();
+   rec->used = 0;
+}
+
+/* rc_online() - participant may begin to hold references */
+void rc_online(rc_record* rec) {
+   rec->epoch = global_epoch;
+   rec->online = true;
+   AO_nop_full();
+   rec->epoch = global_epoch;
+}
+
+/* rc_offline() - participant holds no references until it is back online */
+void rc_offline(rc_record* rec) {
+   BARRIER();
+   rec->online = false;
+}
+
+/* rc_quiescent() - participant holds no references at this point */
+void rc_quiescent(rc_record* rec) {
+   BARRIER();
+   rec->epoch = global_epoch;
+}
+
+/* rc_try_advance() - advance the global epoch if every online participant has observed it */
+static unsigned long rc_try_advance(void) {
+   unsigned long cur = global_epoch;
+   for(int i = 0; i < RC_MAX_RECORDS; ++i) {
+      if(records[i].used && records[i].online && records[i].epoch != cur) return cur;
+   }
+   CAS(&global_epoch, cur, cur + 1);
+   return global_epoch;
+}
+
+/* rc_limbo_new() - create an empty limbo list */
+rc_limbo* rc_limbo_new(void) {
+   rc_limbo* limbo = (rc_limbo*)malloc(sizeof(rc_limbo));
+   limbo->cap = 256;
+   limbo->head = limbo->count = limbo->since_scan = 0;
+   limbo->entries = (rc_entry*)malloc(limbo->cap * sizeof(rc_entry));
+   return limbo;
+}
+
+/* rc_limbo_free() - free every retired object (caller guarantees no readers remain) */
+void rc_limbo_free(rc_limbo* limbo) {
+   for(int i = limbo->head; i < limbo->count; ++i) {
+      rc_entry* e = &limbo->entries[i];
+      e->fn(e->ptr, e->arg);
+   }
+   free(limbo->entries);
+   free(limbo);
+}
+
+/* rc_append() - add an entry stamped with the current epoch to the limbo list */
+static void rc_append(rc_limbo* limbo, void* ptr, rc_free_fn fn, int arg, int periods) {
+   if(limbo->count == limbo->cap) {
+      if(limbo->head > 0) {
+         // compact freed prefix
+         limbo->count -= limbo->head;
+         memmove(limbo->entries, limbo->entries + limbo->head, limbo->count * sizeof(rc_entry));
+         limbo->head = 0;
+      } else {
+         limbo->cap *= 2;
+         limbo->entries = (rc_entry*)realloc(limbo->entries, limbo->cap * sizeof(rc_entry));
+      }
+   }
+   // the unlink must be visible before we read the epoch
+   AO_nop_full();
+   rc_entry* e = &limbo->entries[limbo->count++];
+   e->ptr     = ptr;
+   e->fn      = fn;
+   e->arg     = arg;
+   e->periods = periods;
+   e->epoch   = global_epoch;
+}
+
+/**
+ * rc_retire() - defer freeing of an object which is no longer reachable
+ * @limbo - the retiring context's limbo list
+ * @ptr   - the unlinked object
+ * @fn    - function which frees the object
+ * @arg   - argument passed to @fn (e.g. the enclave id)
+ */
+void rc_retire(rc_limbo* limbo, void* ptr, rc_free_fn fn, int arg) {
+   rc_retire_staged(limbo, ptr, fn, arg, 1);
+}
+
+/**
+ * rc_retire_staged() - defer freeing of an object for several consecutive grace periods
+ * @limbo   - the retiring context's limbo list
+ * @ptr     - the unlinked object
+ * @fn      - function which frees the object
+ * @arg     - argument passed to @fn
+ * @periods - number of grace periods to wait
+ */
+void rc_retire_staged(rc_limbo* limbo, void* ptr, rc_free_fn fn, int arg, int periods) {
+   rc_append(limbo, ptr, fn, arg, periods);
+   if(++limbo->since_scan >= RC_SCAN_BATCH) {
+      rc_reclaim(limbo);
+   }
+}
+
+/* rc_reclaim() - free every retired object whose grace period has elapsed */
+void rc_reclaim(rc_limbo* limbo) {
+   limbo->since_scan = 0;
+   if(limbo->head == limbo->count) return;
+   unsigned long cur = rc_try_advance();
+   while(limbo->head < limbo->count) {
+      rc_entry e = limbo->entries[limbo->head];
+      if(e.epoch + RC_GRACE > cur) break;
+      limbo->head++;
+      if(e.periods > 1) {
+         // start the next grace period (re-stamped entries stop this scan)
+         rc_append(limbo, e.ptr, e.fn, e.arg, e.periods - 1);
+      } else {
+         e.fn(e.ptr, e.arg);
+      }
+   }
+   if(limbo->head == limbo->count) {
+      limbo->head = limbo->count = 0;
+   }
+}
@@ -0,0 +1,54 @@
+/*
+ * Interface for epoch-based memory reclamation
+ *
+ * Author: Henry Daly, 2018
+ */
+#ifndef RECLAIM_H_
+#define RECLAIM_H_
+
+#include "common.h"
+
+#define RC_MAX_RECORDS  1024
+#define RC_GRACE        2     // epochs an object waits in limbo before being freed
+#define RC_SCAN_BATCH   64    // retirements between reclamation attempts
+
+typedef void (*rc_free_fn)(void* ptr, int arg);
+
+/* rc_record is the per-participant epoch announcement (one per reading/maintaining context) */
+struct rc_record {
+   volatile unsigned long  epoch;   // last global epoch observed at a quiescent point
+   volatile AO_t           used;    // record is claimed
+   volatile bool           online;  // offline records never hold references
+   CACHE_PAD(0);
+};
+
+/* rc_entry is a retired object waiting for its grace period */
+struct rc_entry {
+   void*          ptr;
+   rc_free_fn     fn;
+   int            arg;
+   int            periods;   // grace periods still to wait (re-stamped after each)
+   unsigned long  epoch;
+};
+
+/* rc_limbo holds the objects retired by a single (non-concurrent) context */
+struct rc_limbo {
+   rc_entry*   entries;
+   int         head;
+   int         count;
+   int         cap;
+   int         since_scan;
+};
+
+rc_record*  rc_register(void);
+void        rc_unregister(rc_record* rec);
+void        rc_online(rc_record* rec);
+void        rc_offline(rc_record* rec);
+void        rc_quiescent(rc_record* rec);
+rc_limbo*   rc_limbo_new(void);
+void        rc_limbo_free(rc_limbo* limbo);
+void        rc_retire(rc_limbo* limbo, void* ptr, rc_free_fn fn, int arg);
+void        rc_retire_staged(rc_limbo* limbo, void* ptr, rc_free_fn fn, int arg, int periods);
+void        rc_reclaim(rc_limbo* limbo);
+
+#endif /* RECLAIM_H_ */
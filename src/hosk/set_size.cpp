@@ -0,0 +1,109 @@
+/*
+ * set_size.cpp: per-enclave counters of the set size
+ *
+ * Author: Henry Daly, 2018
+ */
+
+/**
+ * Module Overview:
+ *
+ * Walking the data layer to find the set size takes time linear in the set size. Instead,
+ * the application thread of every enclave counts its successful inserts and deletes, and
+ * the helper thread counts the keys of its intermediate layer. Each enclave's counters sit
+ * on their own cache lines, so counting never shares a line with another thread's writes.
+ *
+ * The approximate size is the sum of the insert counters minus the delete counters: it
+ * misses the updates which took effect but were not counted yet.
+ *
+ * In exact mode, the application thread also makes its sequence number odd for the
+ * duration of every update. An exact size collects all sequence numbers, then the
+ * counters, then the sequence numbers again: if no sequence number was odd or changed,
+ * no update was in flight in between, and the counters are the size of the set at that
+ * moment (so the size is linearizable). After SZ_COLLECTS failed collects, the gate holds
+ * back the updates which did not start yet until a collect succeeds.
+ */
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "enclave.h"
+#include "set_size.h"
+
+bool          sz_exact = false;
+volatile AO_t sz_gate  = 0;
+
+/* sz_new() - allocate zeroed counters */
+sz_counter* sz_new(void) {
+   void* c = NULL;
+   if(0 != posix_memalign(&c, CACHE_LINE_SIZE, sizeof(sz_counter))) {
+      perror("posix_memalign");
+      exit(1);
+   }
+   memset(c, 0, sizeof(sz_counter));
+   return (sz_counter*)c;
+}
+
+/* sz_free() - free counters */
+void sz_free(sz_counter* c) {
+   free(c);
+}
+
+/* sz_set_exact() - make the application threads track their updates in flight (before the run) */
+void sz_set_exact(bool exact) {
+   sz_exact = exact;
+}
+
+/* collect() - sum the counters of all enclaves */
+static long collect(enclave** enclaves, int num_enclaves) {
+   long size = 0;
+   for(int i = 0; i < num_enclaves; ++i) {
+      sz_counter* c = enclaves[i]->size;
+      size += (long)AO_load_full(&c->inserts) - (long)AO_load_full(&c->deletes);
+   }
+   return size;
+}
+
+/* stable_collect() - sum the counters if no update is in flight in the meantime (-1 if one was) */
+static long stable_collect(enclave** enclaves, int num_enclaves, AO_t* seqs) {
+   for(int i = 0; i < num_enclaves; ++i) {
+      seqs[i] = AO_load_full(&enclaves[i]->size->seq);
+      if(seqs[i] & 1) return -1;
+   }
+   long size = collect(enclaves, num_enclaves);
+   for(int i = 0; i < num_enclaves; ++i) {
+      if(AO_load_full(&enclaves[i]->size->seq) != seqs[i]) return -1;
+   }
+   return size;
+}
+
+/**
+ * sz_size() - the number of keys in the set
+ * @enclaves     - all enclaves
+ * @num_enclaves - the number of enclaves
+ * @exact        - linearizable size (requires sz_set_exact()) rather than approximate
+ */
+long sz_size(enclave** enclaves, int num_enclaves, bool exact) {
+   if(!exact || !sz_exact) return collect(enclaves, num_enclaves);
+
+   AO_t* seqs = (AO_t*)malloc(num_enclaves * sizeof(AO_t));
+   long size;
+   int tries = 0;
+   while(-1 == (size = stable_collect(enclaves, num_enclaves, seqs))) {
+      if(++tries == SZ_COLLECTS) AO_fetch_and_add1_full(&sz_gate);
+      // let a descheduled update finish
+      if(tries >= SZ_COLLECTS) sched_yield();
+   }
+   if(tries >= SZ_COLLECTS) AO_fetch_and_sub1_full(&sz_gate);
+   free(seqs);
+   return size;
+}
+
+/* sz_indexed() - the number of keys in the intermediate layers */
+long sz_indexed(enclave** enclaves, int num_enclaves) {
+   long indexed = 0;
+   for(int i = 0; i < num_enclaves; ++i) {
+      indexed += (long)AO_load_full(&enclaves[i]->size->indexed);
+   }
+   return indexed;
+}
@@ -0,0 +1,58 @@
+/*
+ * Interface for the set size counters
+ *
+ * Author: Henry Daly, 2018
+ */
+#ifndef SET_SIZE_H_
+#define SET_SIZE_H_
+
+#include <atomic_ops.h>
+#include "common.h"
+
+#define SZ_COLLECTS  64     // failed exact collects before updates are held back
+
+class enclave;
+
+/* sz_counter holds the size counters of an enclave, a cache line per writing thread */
+struct sz_counter {
+   // written by the application thread
+   volatile AO_t  seq;        // odd while an update is in flight (exact mode only)
+   volatile AO_t  inserts;    // successful inserts
+   volatile AO_t  deletes;    // successful deletes
+   char           pad1[CACHE_LINE_SIZE - 3 * sizeof(AO_t)];
+   // written by the helper thread
+   volatile AO_t  indexed;    // keys in the intermediate layer
+   char           pad2[CACHE_LINE_SIZE - sizeof(AO_t)];
+};
+
+extern bool          sz_exact;
+extern volatile AO_t sz_gate;
+
+sz_counter* sz_new(void);
+void        sz_free(sz_counter* c);
+void        sz_set_exact(bool exact);
+long        sz_size(enclave** enclaves, int num_enclaves, bool exact);
+long        sz_indexed(enclave** enclaves, int num_enclaves);
+
+/* sz_begin() - enter an update of the application thread owning @c */
+static inline void sz_begin(sz_counter* c) {
+   if(!sz_exact) return;
+   while(0 != AO_load_full(&sz_gate)) {}
+   AO_store_full(&c->seq, c->seq + 1);
+}
+
+/**
+ * sz_end() - count an update of the application thread owning @c and leave it
+ * @c      - the counters of the enclave
+ * @insert - true for an insert, false for a delete
+ * @done   - true if the update succeeded
+ */
+static inline void sz_end(sz_counter* c, bool insert, bool done) {
+   if(done) {
+      if(insert) AO_store_release(&c->inserts, c->inserts + 1);
+      else       AO_store_release(&c->deletes, c->deletes + 1);
+   }
+   if(sz_exact) AO_store_release(&c->seq, c->seq + 1);
+}
+
+#endif /* SET_SIZE_H_ */
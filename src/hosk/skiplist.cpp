@@ -10,11 +10,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "allocator.h"
+#include "cold.h"
 #include "common.h"
+#include "node_pool.h"
 #include "skiplist.h"
 
 numa_allocator** allocators;
 extern bool base_malloc;
+char dl_moving_tag;
 
 #define NODE_SZ   sizeof(node_t)
 #define INODE_SZ  sizeof(inode_t)
@@ -26,7 +29,7 @@ extern bool base_malloc;
 
 /* - Public skiplist interface - */
 /**
- * node_new() - create a new data layer node
+ * node_new() - create a new data layer node (placed by the data node pool policy)
  * @key  - the key for the new node
  * @val  - the val for the new node
  * @prev - the prev node pointer for the new node
@@ -34,12 +37,13 @@ extern bool base_malloc;
  */
 node_t* node_new(sl_key_t key, val_t val, node_t *prev, node_t *next) {
    node_t *node;
-   node = (node_t*)malloc(NODE_SZ);
+   node = (node_t*)np_alloc(key);
    node->key   = key;
    node->val   = val;
    node->prev  = prev;
    node->next  = next;
    node->level = 0;
+   node->seg   = false;
    return node;
 }
 
@@ -85,7 +89,9 @@ mnode_t* mnode_new(mnode_t* next, node_t* node, unsigned int level, int enclave_
    mnode->key     = node->key;
    mnode->next    = next;
    mnode->marked  = false;
+   mnode->sweep   = false;
    mnode->node    = node;
+   mnode->chunk   = 0;
    return mnode;
 }
 
@@ -94,7 +100,7 @@ mnode_t* mnode_new(mnode_t* next, node_t* node, unsigned int level, int enclave_
  * @node - the node to delete
  */
 void node_delete(node_t *node) {
-   free((void*)node);
+   np_free((void*)node);
 }
 
 /**
@@ -123,12 +129,14 @@ void mnode_delete(mnode_t* mnode, int enclave_id) {
  * @flag - specifies if we include logically deleted nodes
  *
  */
-int data_layer_size(node_t* head, int flag) {
+long data_layer_size(node_t* head, int flag) {
    struct sl_node *node = head;
-   int size = 0;
+   long size = 0;
    node = node->next;
    while (NULL != node) {
-      if (flag && (NULL != node->val && node != node->val)) {
+      if (flag && node->seg && node != node->val && DL_MOVING != node->val) {
+         size += ((cold_block*)node->val)->live;
+      } else if (flag && (NULL != node->val && node != node->val && DL_MOVING != node->val)) {
          ++size;
       } else if (!flag && node->key != 0) {
          ++size;
@@ -138,8 +146,8 @@ int data_layer_size(node_t* head, int flag) {
    return size;
 }
 
-int intermed_layer_size(mnode_t* head) {
-   int size = 0;
+long intermed_layer_size(mnode_t* head) {
+   long size = 0;
    mnode_t* m = head;
    while(m) {
       if(!m->marked) size++;
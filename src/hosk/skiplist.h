@@ -27,6 +27,7 @@ struct sl_node {
    val_t             val;
    sl_key_t          key;
    volatile uint     level;
+   bool              seg;     // val is the immutable block of a cold segment (see cold.h)
 };
 
 /* index layer nodes */
@@ -37,15 +38,21 @@ struct sl_inode {
    sl_key_t          key;
 };
 
-/* intermediate layer nodes */
+/* intermediate layer nodes (level is narrowed so the chunk id fits in half a cache line) */
 struct sl_mnode {
    struct sl_mnode*  next;
    struct sl_node*   node;
    sl_key_t          key;
-   unsigned int      level;
+   unsigned short    level;
    bool              marked;
+   bool              sweep;   // a key of the data layer gap after this node was deleted
+   uint              chunk;   // id of the intermediate chunk holding this node (0 = none)
 };
 
+/* value of a migrated copy until the value of the original is transferred to it */
+extern char dl_moving_tag;
+#define DL_MOVING ((val_t)&dl_moving_tag)
+
 typedef VOLATILE struct sl_node  node_t;
 typedef VOLATILE struct sl_inode inode_t;
 typedef VOLATILE struct sl_mnode mnode_t;
@@ -57,8 +64,8 @@ mnode_t* mnode_new(mnode_t* next, node_t* node, unsigned int level, int cpu);
 void node_delete(node_t *node);
 void inode_delete(inode_t *inode, int cpu);
 void mnode_delete(mnode_t* mnode, int cpu);
-int data_layer_size(node_t* head, int flag);
-int intermed_layer_size(mnode_t* head);
+long data_layer_size(node_t* head, int flag);
+long intermed_layer_size(mnode_t* head);
 
 
 #ifdef ADDRESS_CHECKING
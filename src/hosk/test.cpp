@@ -17,21 +17,30 @@
 
 #include <assert.h>
 #include <atomic_ops.h>
+#include <ctype.h>
 #include <getopt.h>
 #include <limits.h>
 #include <numa.h>
 #include <pthread.h>
+#include <sched.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/time.h>
 #include <time.h>
 #include <unistd.h>
 #include "allocator.h"
+#include "bulk_load.h"
 #include "common.h"
 #include "enclave.h"
 #include "hardware_layout.h"
+#include "helper_pool.h"
+#include "mem_account.h"
+#include "node_pool.h"
+#include "set_size.h"
+#include "virtual_numa.h"
 #include "skiplist.h"
 
 #define DEFAULT_DURATION               10000
@@ -58,9 +67,14 @@ struct tinit_args {
    core_t*  core;
    uint     sock_num;
    node_t*  node_sentinel;
-   uint     allocator_size;
+   unsigned long allocator_size;
    uint     freq;
    int      buffer_size;
+   bool     learned;
+   bool     chunked;
+   bool     relocate;       // the enclave may move data layer nodes (migration or compaction)
+   int      alloc_flags;
+   barrier_t* ready;        // crossed once the enclave is constructed
 };
 
 int num_numa_zones = MAX_NUMA_ZONES;
@@ -70,6 +84,7 @@ pthread_key_t rng_seed_key;
 unsigned int levelmax;
 enclave** enclaves;
 extern numa_allocator** allocators;
+extern mchunk_dir** chunk_dirs;
 bool base_malloc = true;
 
 void barrier_init(barrier_t *b, int n) {
@@ -94,8 +109,9 @@ void barrier_cross(barrier_t *b) {
    pthread_mutex_unlock(&b->mutex);
 }
 
-int floor_log_2(unsigned int n) {
+int floor_log_2(unsigned long n) {
    int pos = 0;
+   if (n >= 1UL<<32) { n >>= 32; pos += 32; }
    if (n >= 1<<16) { n >>= 16; pos += 16; }
    if (n >= 1<< 8) { n >>=  8; pos +=  8; }
    if (n >= 1<< 4) { n >>=  4; pos +=  4; }
@@ -106,7 +122,97 @@ int floor_log_2(unsigned int n) {
 
 void catcher(int sig) { printf("CAUGHT SIGNAL %d\n", sig); }
 
-/* thread_init() - initializes the enclave object for a thread */
+/* print_latency() - print the median and 99th percentile of a latency histogram */
+void print_latency(const char* name, unsigned long* lat) {
+   unsigned long timed = 0, seen = 0;
+   int p50 = -1, p99 = -1;
+   for(int b = 0; b < LAT_BUCKETS; ++b) timed += lat[b];
+   if(timed == 0) return;
+   for(int b = 0; b < LAT_BUCKETS; ++b) {
+      seen += lat[b];
+      if(p50 < 0 && seen * 100 >= timed * 50) p50 = b;
+      if(p99 < 0 && seen * 100 >= timed * 99) p99 = b;
+   }
+   printf("%s: p50 < %d ns, p99 < %d ns (%lu timed%s)\n", name, (p50 + 1) * LAT_NS, (p99 + 1) * LAT_NS,
+          timed, p99 == LAT_BUCKETS - 1 ? ", p99 overflows" : "");
+}
+
+/**
+ * validate() - check the layers in parallel and print the set size and its data zones
+ *  (exits unless the layers are in order and hold @expected keys)
+ * @enclaves   - all enclaves (no thread may update the skip list meanwhile)
+ * @nb_threads - the number of enclaves
+ * @range      - the key range
+ * @zones      - the number of NUMA zones printed
+ * @expected   - the expected set size
+ * @mem        - memory report whose data layer nodes are counted on the way (NULL to skip)
+ */
+void validate(enclave** enclaves, int nb_threads, long range, int zones, long expected, ma_report* mem) {
+   long indexed = 0;
+   long* zone_keys = (long*)calloc(NP_MAX_ZONES, sizeof(long));
+   struct timeval t0, t1;
+   gettimeofday(&t0, NULL);
+   long keys = bl_validate(enclaves, nb_threads, range, &indexed, zone_keys, mem);
+   gettimeofday(&t1, NULL);
+   printf("Validated     : %ld keys, %ld indexed (%ld us)\n", keys, indexed,
+          (t1.tv_sec - t0.tv_sec) * 1000000L + (t1.tv_usec - t0.tv_usec));
+   printf("Data zones    :");
+   for(int z = 0; z < zones && z < NP_MAX_ZONES; ++z) {
+      printf(" %d: %ld", z, zone_keys[z]);
+   }
+   printf("\n");
+   free(zone_keys);
+   if(keys != expected) {
+      printf("ERROR: validation found %ld keys, expected %ld\n", keys, expected);
+      exit(1);
+   }
+}
+
+/* print_memory() - print the memory of each layer, by NUMA zone (at least @zones) and by enclave */
+void print_memory(ma_report* r, int zones) {
+   unsigned long reserved = ma_reserved(r), used = ma_used(r);
+   unsigned long linked = r->live + r->deleted + r->markers + r->removed + r->segments;
+   unsigned long allocated = 0;
+   for(int z = 0; z < NP_MAX_ZONES; ++z) allocated += r->pool.nodes[z];
+   for(int i = 0; i < r->num_enclaves; ++i) {
+      if(r->enclaves[i].zone >= zones) zones = r->enclaves[i].zone + 1;
+   }
+   printf("Memory        : %lu bytes reserved, %lu used\n", reserved, used);
+   if(r->live_keys > 0) {
+      printf("  bytes/key   : %f reserved, %f used (%ld live keys)\n",
+             (double)reserved / r->live_keys, (double)used / r->live_keys, r->live_keys);
+   }
+   printf("  data nodes  : %lu live, %lu deleted, %lu markers, %lu unlinking, %lu segments, %lu unlinked (%lu bytes each)\n",
+          r->live, r->deleted, r->markers, r->removed, r->segments,
+          allocated > linked ? allocated - linked : 0, sizeof(sl_node));
+   if(r->segments > 0) printf("  cold blocks : %lu bytes\n", r->cold_bytes);
+   for(int z = 0; z < zones && z < NP_MAX_ZONES; ++z) {
+      unsigned long index = 0, intermed = 0, alloc_used = 0, alloc_reserved = 0;
+      for(int i = 0; i < r->num_enclaves; ++i) {
+         ma_enclave* e = &r->enclaves[i];
+         if(e->zone != z) continue;
+         index          += e->inodes * sizeof(sl_inode);
+         intermed       += e->mnodes * sizeof(sl_mnode) + e->chunks * sizeof(sl_mchunk);
+         alloc_used     += e->alloc.used;
+         alloc_reserved += e->alloc.reserved;
+      }
+      printf("  zone %-2d     : data %lu (%lu slabs), index %lu, intermediate %lu, allocators %lu of %lu\n",
+             z, ma_data_bytes(r, z), r->pool.slabs[z], index, intermed, alloc_used, alloc_reserved);
+   }
+   for(int i = 0; i < r->num_enclaves; ++i) {
+      ma_enclave* e = &r->enclaves[i];
+      printf("  enclave %-2d  : zone %d, %lu index nodes, %lu intermediate nodes, %lu chunks, model %lu\n",
+             i, e->zone, e->inodes, e->mnodes, e->chunks, e->model);
+      printf("    allocator : %lu reserved, %lu used, %lu padding, %lu dead, %lu idle\n",
+             e->alloc.reserved, e->alloc.used, e->alloc.padding, e->alloc.dead, e->alloc.idle);
+      printf("    opbuffer  : %lu of %lu bytes pending\n", e->op_pending, e->op_capacity);
+   }
+}
+
+/**
+ * thread_init() - initializes the enclave object for a thread, which then serves as the
+ *  enclave's application thread until the enclave is destroyed
+ */
 void* thread_init(void* args) {
    tinit_args* zia = (tinit_args*)args;
    int athread_id = zia->core->hwthread_id[APP_IDX];
@@ -117,15 +223,26 @@ void* thread_init(void* args) {
    CPU_ZERO(&cpuset);
    CPU_SET(athread_id, &cpuset);
    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
-   numa_set_preferred(zia->sock_num);
-   sleep(1);
+   numa_set_preferred(vn_node(zia->sock_num));
 
-   numa_allocator* na = new numa_allocator(zia->allocator_size);
+   // NOTE: with NA_PREFAULT, every enclave faults in its own arena here, in parallel
+   numa_allocator* na = new numa_allocator(zia->allocator_size, zia->alloc_flags);
    allocators[zia->enclave_num] = na;
+   node_pools[zia->enclave_num] = np_cache_new(zia->sock_num);
+   helper_pools[zia->enclave_num] = np_cache_new(zia->sock_num);
+   np_thread_init(node_pools[zia->enclave_num]);
    mnode_t* mnode = mnode_new(NULL, zia->node_sentinel, 1, zia->enclave_num);
    inode_t* inode = inode_new(NULL, NULL, mnode, zia->enclave_num);
    enclave* en = new enclave(zia->core, zia->sock_num, inode, zia->freq, zia->enclave_num, zia->buffer_size);
+   en->learned = zia->learned;
+   if(zia->chunked) {
+      en->chunks = mchunk_dir_new(zia->enclave_num);
+   }
+   if(zia->relocate) {
+      en->mig = mig_new(zia->enclave_num);
+   }
    enclaves[zia->enclave_num] = en;
+   en->serve(zia->ready);
    return NULL;
 }
 
@@ -145,10 +262,40 @@ int main(int argc, char **argv) {
       {"seed",                      required_argument, NULL, 's'},
       {"update-rate",               required_argument, NULL, 'u'},
       {"elasticity",                required_argument, NULL, 'x'},
+      {"learned-index",             no_argument,       NULL, 'L'},
+      {"chunked",                   no_argument,       NULL, 'C'},
+      {"hugepages",                 no_argument,       NULL, 'H'},
+      {"prefault",                  no_argument,       NULL, 'F'},
+      {"mlock",                     no_argument,       NULL, 'M'},
+      {"placement",                 required_argument, NULL, 'N'},
+      {"migrate",                   no_argument,       NULL, 'G'},
+      {"hotspot",                   required_argument, NULL, 'K'},
+      {"compact",                   required_argument, NULL, 'O'},
+      {"scan",                      required_argument, NULL, 'W'},
+      {"cold",                      required_argument, NULL, 'X'},
+      {"freeze",                    no_argument,       NULL, 'Z'},
+      {"deferred-unlink",           no_argument,       NULL, 'D'},
+      {"backoff",                   required_argument, NULL, 'B'},
+      {"rewalk",                    no_argument,       NULL, 'R'},
+      {"eliminate",                 no_argument,       NULL, 'E'},
+      {"read-your-writes",          no_argument,       NULL, 'I'},
+      {"exact-size",                no_argument,       NULL, 'q'},
+      {"size-poll",                 required_argument, NULL, 'Q'},
+      {"inline",                    required_argument, NULL, 'T'},
+      {"helper-pool",               required_argument, NULL, 'p'},
+      {"idle",                      no_argument,       NULL, 'J'},
+      {"sched-idle",                no_argument,       NULL, 'j'},
+      {"lend",                      required_argument, NULL, 'Y'},
+      {"enclave-placement",         required_argument, NULL, 'e'},
+      {"virtual-numa",              required_argument, NULL, 'V'},
+      {"remote-cost",               required_argument, NULL, 'c'},
+      {"bulk-load",                 required_argument, NULL, 'b'},
+      {"large-scale",               no_argument,       NULL, 'l'},
       {NULL, 0, NULL, 0}
    };
 
-   int i, c, size;
+   int i, c;
+   long size;
    unsigned int val = 0;
    unsigned long adds = 0, removes = 0;
    unsigned long reads = 0, effreads = 0, updates = 0, effupds = 0;
@@ -159,7 +306,7 @@ int main(int argc, char **argv) {
    struct timeval start, end;
    struct timespec timeout;
    int duration = DEFAULT_DURATION;
-   int initial = DEFAULT_INITIAL;
+   long initial = DEFAULT_INITIAL;
    int nb_threads = DEFAULT_NB_THREADS;
    long range = DEFAULT_RANGE;
    int seed = DEFAULT_SEED;
@@ -170,9 +317,38 @@ int main(int argc, char **argv) {
    sigset_t block_set;
    struct sl_node *temp;
    int unbalanced = DEFAULT_UNBALANCED;
+   bool learned = false;
+   bool chunked = false;
+   int alloc_flags = 0;
+   int placement = NP_LOCAL;
+   bool migrate = false;
+   int hotspot = 0;
+   long compact = 0;
+   int scan = 0;
+   int cold = 0;
+   bool freeze = false;
+   bool deferred = false;
+   int backoff = CM_NONE;
+   bool rewalk = false;
+   bool eliminate = false;
+   bool ryw = false;
+   bool exact = false;
+   int poll = 0;
+   int inline_ops = 0;
+   int pool_size = 0;
+   bool idling = false;
+   bool sched_idle = false;
+   int lend_depth = 0;
+   int enclave_policy = HL_SCATTER;
+   const char* enclave_cpus = NULL;
+   int vsockets = 0, vcores = 0;
+   int remote_cost = -1;
+   bool zones_set = false;
+   int bulk = -1;
+   bool large = false;
    while(1) {
       i = 0;
-      c = getopt_long(argc, argv, "hAf:d:i:t:r:S:u:U:z:P:y:", long_options, &i);
+      c = getopt_long(argc, argv, "hALCHFMGZDREIqJjlB:N:K:O:W:X:Q:T:Y:e:V:c:b:p:f:d:i:t:r:S:u:U:z:P:y:", long_options, &i);
       if(c == -1) break;
       if(c == 0 && long_options[i].flag == 0) { c = long_options[i].val; }
       switch(c) {
@@ -206,12 +382,188 @@ int main(int argc, char **argv) {
                    "  -z <int>\n"
                    "        Number of NUMA zones to use (default = " XSTR(MAX_NUMA_ZONES) ")\n"
                    "  -y <int>\n"
-                   "        Frequency of index layer updates"
+                   "        Frequency of index layer updates\n"
+                   "  -L, --learned-index\n"
+                   "        Enter the data layer through a learned (piecewise-linear) model of each enclave's intermediate layer\n"
+                   "  -C, --chunked\n"
+                   "        Mirror each intermediate layer into cache-line chunks searched by the application thread\n"
+                   "  -H, --hugepages\n"
+                   "        Back allocator arenas with huge pages (MAP_HUGETLB, else transparent huge pages)\n"
+                   "  -F, --prefault\n"
+                   "        Fault allocator arenas in when they are mapped\n"
+                   "  -M, --mlock\n"
+                   "        Lock allocator arenas in memory\n"
+                   "  -e, --enclave-placement <scatter|compact|distance|cpu list>\n"
+                   "        Cores of the enclaves: round-robin across sockets, socket by socket, socket by socket in NUMA distance order,\n"
+                   "        or the application threads' hardware threads, e.g. 0,2,8-11 (default=scatter)\n"
+                   "  -V, --virtual-numa <sockets>x<cores>\n"
+                   "        Simulate a topology of <sockets> sockets (each one a NUMA zone) of <cores> cores on the real cores\n"
+                   "  -c, --remote-cost <int>\n"
+                   "        Count the data node accesses by zone, charging <int> ns per access to another zone's node (0=count only)\n"
+                   "  -N, --placement <local|interleave|range>\n"
+                   "        NUMA placement of data layer nodes: inserting thread's zone, round-robin, or key range home zone (default=local)\n"
+                   "  -G, --migrate\n"
+                   "        Move data layer nodes often accessed from a remote NUMA zone to that zone\n"
+                   "  -K, --hotspot <int>\n"
+                   "        Percentage of operations on a hot slice of the key range, which shifts over time (default=0)\n"
+                   "  -O, --compact <int>\n"
+                   "        Milliseconds between two key order compaction passes of each enclave's slice of the data layer (0=off, default=0)\n"
+                   "  -W, --scan <int>\n"
+                   "        Read operations are range scans of <int> keys (default=0: contains)\n"
+                   "  -X, --cold <int>\n"
+                   "        Compress key ranges without updates for <int> rounds of " XSTR(COLD_ROUND_MS) " ms into cold segments (0=off, default=0)\n"
+                   "  -Z, --freeze\n"
+                   "        Serve the read-only run from a frozen replica of the skip list on each NUMA zone (requires -u 0)\n"
+                   "  -D, --deferred-unlink\n"
+                   "        Application threads skip deleted data layer nodes, which helper threads unlink in batches\n"
+                   "  -B, --backoff <none|exp|prop>\n"
+                   "        Backoff of an update whose data layer CAS failed: none, exponential or proportional (default=none)\n"
+                   "  -R, --rewalk\n"
+                   "        Retry a failed update from its index layer entry node instead of its predecessor\n"
+                   "  -E, --eliminate\n"
+                   "        Cancel out concurrent inserts and deletes of the same contended key without updating the data layer\n"
+                   "  -I, --read-your-writes\n"
+                   "        Enter the data layer through the application thread's own inserts until they are indexed\n"
+                   "  -q, --exact-size\n"
+                   "        Set size queries are linearizable instead of approximate (updates track when they are in flight)\n"
+                   "  -Q, --size-poll <int>\n"
+                   "        Query the set size every <int> milliseconds during the run (0=off, default=0)\n"
+                   "  -T, --inline <int>\n"
+                   "        No helper threads: application threads maintain their index layers every <int> operations (0=off, default=0)\n"
+                   "  -p, --helper-pool <int>\n"
+                   "        <int> helper threads per socket, on hardware threads of their own, serve all the socket's enclaves (0=off, default=0)\n"
+                   "  -J, --idle\n"
+                   "        Helper threads spin with pause and then sleep while they have no work (woken up by new operations)\n"
+                   "  -j, --sched-idle\n"
+                   "        Helper threads run under SCHED_IDLE, yielding their hardware thread to any other thread\n"
+                   "  -Y, --lend <int>\n"
+                   "        Helper threads run reads while their opbuffer is empty, until <int> operations are pending (0=off, default=0)\n"
+                   "  -b, --bulk-load <sorted|unsorted>\n"
+                   "        Populate with a parallel bulk load of keys generated in order, or out of order (sorted in parallel)\n"
+                   "  -l, --large-scale\n"
+                   "        Billions of keys: bulk load (sorted unless -b is given) and validate the layers in parallel after the load\n"
+                   "        and after the run instead of walking the data layer on the main thread\n"
                    );
             exit(0);
          case 'A':
             alternate = 1;
             break;
+         case 'L':
+            learned = true;
+            break;
+         case 'C':
+            chunked = true;
+            break;
+         case 'H':
+            alloc_flags |= NA_HUGEPAGES;
+            break;
+         case 'F':
+            alloc_flags |= NA_PREFAULT;
+            break;
+         case 'M':
+            alloc_flags |= NA_MLOCK;
+            break;
+         case 'N':
+            if(!strcmp(optarg, "local"))            placement = NP_LOCAL;
+            else if(!strcmp(optarg, "interleave"))  placement = NP_INTERLEAVE;
+            else if(!strcmp(optarg, "range"))       placement = NP_RANGE;
+            else {
+               printf("Unknown placement policy: %s\n", optarg);
+               exit(1);
+            }
+            break;
+         case 'e':
+            if(!strcmp(optarg, "scatter"))          enclave_policy = HL_SCATTER;
+            else if(!strcmp(optarg, "compact"))     enclave_policy = HL_COMPACT;
+            else if(!strcmp(optarg, "distance"))    enclave_policy = HL_DISTANCE;
+            else if(isdigit(optarg[0])) {
+               enclave_policy = HL_CPUS;
+               enclave_cpus   = optarg;
+            } else {
+               printf("Unknown enclave placement policy: %s\n", optarg);
+               exit(1);
+            }
+            break;
+         case 'V':
+            if(2 != sscanf(optarg, "%dx%d", &vsockets, &vcores) || vsockets < 1 || vcores < 1) {
+               printf("Invalid virtual topology: %s\n", optarg);
+               exit(1);
+            }
+            break;
+         case 'c':
+            remote_cost = atoi(optarg);
+            break;
+         case 'l':
+            large = true;
+            break;
+         case 'b':
+            if(!strcmp(optarg, "sorted"))          bulk = 1;
+            else if(!strcmp(optarg, "unsorted"))   bulk = 0;
+            else {
+               printf("Unknown bulk load mode: %s\n", optarg);
+               exit(1);
+            }
+            break;
+         case 'G':
+            migrate = true;
+            break;
+         case 'K':
+            hotspot = atoi(optarg);
+            break;
+         case 'O':
+            compact = atol(optarg);
+            break;
+         case 'W':
+            scan = atoi(optarg);
+            break;
+         case 'X':
+            cold = atoi(optarg);
+            break;
+         case 'Z':
+            freeze = true;
+            break;
+         case 'D':
+            deferred = true;
+            break;
+         case 'B':
+            if(!strcmp(optarg, "none"))         backoff = CM_NONE;
+            else if(!strcmp(optarg, "exp"))     backoff = CM_EXPONENTIAL;
+            else if(!strcmp(optarg, "prop"))    backoff = CM_PROPORTIONAL;
+            else {
+               printf("Unknown backoff policy: %s\n", optarg);
+               exit(1);
+            }
+            break;
+         case 'R':
+            rewalk = true;
+            break;
+         case 'E':
+            eliminate = true;
+            break;
+         case 'I':
+            ryw = true;
+            break;
+         case 'q':
+            exact = true;
+            break;
+         case 'Q':
+            poll = atoi(optarg);
+            break;
+         case 'T':
+            inline_ops = atoi(optarg);
+            break;
+         case 'p':
+            pool_size = atoi(optarg);
+            break;
+         case 'J':
+            idling = true;
+            break;
+         case 'j':
+            sched_idle = true;
+            break;
+         case 'Y':
+            lend_depth = atoi(optarg);
+            break;
          case 'f':
             effective = atoi(optarg);
             break;
@@ -219,7 +571,7 @@ int main(int argc, char **argv) {
             duration = atoi(optarg);
             break;
          case 'i':
-            initial = atoi(optarg);
+            initial = atol(optarg);
             break;
          case 't':
             nb_threads = atoi(optarg);
@@ -238,6 +590,7 @@ int main(int argc, char **argv) {
             break;
          case 'z':
             num_numa_zones = atoi(optarg);
+            zones_set = true;
             break;
          case 'y':
             update_frequency = atoi(optarg);
@@ -251,21 +604,55 @@ int main(int argc, char **argv) {
 
    assert(duration >= 0);
    assert(initial >= 0);
-   assert(nb_threads > 1);
+   assert(nb_threads > 0);
+   assert(inline_ops >= 0);
+   assert(pool_size >= 0);
+   if(pool_size > 0 && inline_ops > 0) {
+      printf("ERROR: the helper pool (-p) serves helper passes, which inline mode (-T) runs itself\n");
+      exit(1);
+   }
+   if(pool_size > 0 && enclave_policy != HL_SCATTER) {
+      // (pooled application threads are pinned round-robin by socket, as scatter places enclaves)
+      printf("ERROR: the helper pool (-p) needs the scatter enclave placement (-e scatter)\n");
+      exit(1);
+   }
+   assert(lend_depth >= 0);
+   if(lend_depth > 0 && (inline_ops > 0 || pool_size > 0 || migrate)) {
+      // (lent reads run on the enclave's own helper thread; with -G they would also write the
+      // application thread's sample ring, which has a single writer)
+      printf("ERROR: lending helper threads (-Y) needs per-enclave helper threads without -T, -p or -G\n");
+      exit(1);
+   }
    assert(range > 0 && range >= initial);
    assert(update >= 0 && update <= 100);
-   assert(num_numa_zones >= MIN_NUMA_ZONES && num_numa_zones <= MAX_NUMA_ZONES);
+   if(freeze && update > 0) {
+      printf("ERROR: a frozen set (-Z) is read-only: use -u 0\n");
+      exit(1);
+   }
+   if(vsockets > 0 && !zones_set) num_numa_zones = vsockets;
+   if(large && bulk < 0) bulk = 1;
+   assert(vsockets <= NP_MAX_ZONES);
+   assert(num_numa_zones >= MIN_NUMA_ZONES && num_numa_zones <= (vsockets > 0 ? vsockets : MAX_NUMA_ZONES));
    // get hardware info
    hl_t* cur_hw = get_hardware_layout();
+   if(vsockets > 0) {
+      hl_t* real_hw = cur_hw;
+      cur_hw = vn_layout(real_hw, vsockets, vcores);
+      free_hardware_layout(real_hw);
+   }
+   if(remote_cost >= 0) vn_set_cost(remote_cost);
 
    int max_thread_num = cur_hw->max_cpu_num;
-   if(nb_threads * 2 > max_thread_num) {
-      printf("ERROR: application thread <= %d (max hw threads) / 2. Changing to %d.\n", max_thread_num, (max_thread_num / 2));
+   int threads_per_enclave = (inline_ops > 0 || pool_size > 0) ? 1 : 2;
+   int pool_threads = pool_size * cur_hw->num_sockets;
+   if(nb_threads * threads_per_enclave + pool_threads > max_thread_num) {
+      printf("ERROR: application thread <= (%d (max hw threads) - %d) / %d. Changing to %d.\n", max_thread_num,
+             pool_threads, threads_per_enclave, ((max_thread_num - pool_threads) / threads_per_enclave));
    }
 
    printf("Set type     : skip list\n");
    printf("Duration     : %d\n", duration);
-   printf("Initial size : %u\n", initial);
+   printf("Initial size : %ld\n", initial);
    printf("Nb threads   : %d\n", nb_threads);
    printf("Value range  : %ld\n", range);
    printf("Seed         : %d\n", seed);
@@ -274,7 +661,30 @@ int main(int argc, char **argv) {
    printf("Effective    : %d\n", effective);
    printf("Type sizes   : int=%d/long=%d/ptr=%d/word=%d\n", (int)sizeof(int), (int)sizeof(long), (int)sizeof(void *), (int)sizeof(uintptr_t));
    printf("NUMA Zones   : %d\n", num_numa_zones);
+   if(vsockets > 0) printf("Topology     : virtual, %d sockets x %d cores\n", vsockets, vcores);
+   if(remote_cost >= 0) printf("Remote cost  : %d ns (%d pauses)\n", remote_cost, vn_pauses);
    printf("Update freq  : %d\n", update_frequency);
+   printf("Index mode   : %s\n", learned ? "learned" : "linked");
+   printf("Intermediate : %s\n", chunked ? "chunked" : "linked");
+   printf("Arena pages  : %s%s%s\n", (alloc_flags & NA_HUGEPAGES) ? "huge" : "base",
+          (alloc_flags & NA_PREFAULT) ? ", prefaulted" : "", (alloc_flags & NA_MLOCK) ? ", locked" : "");
+   printf("Placement    : %s\n", np_policy_name(placement));
+   printf("Enclaves     : %s%s%s\n", hl_policy_name(enclave_policy), enclave_cpus ? " " : "", enclave_cpus ? enclave_cpus : "");
+   printf("Migration    : %s\n", migrate ? "on" : "off");
+   printf("Hotspot      : %d%%\n", hotspot);
+   printf("Compaction   : %ld ms\n", compact);
+   printf("Scan length  : %d\n", scan);
+   printf("Cold rounds  : %d\n", cold);
+   printf("Frozen       : %s\n", freeze ? "yes" : "no");
+   printf("Unlinking    : %s\n", deferred ? "deferred" : "inline");
+   printf("Backoff      : %s, retry from %s\n", cm_policy_name(backoff), rewalk ? "entry" : "predecessor");
+   printf("Elimination  : %s\n", eliminate ? "on" : "off");
+   printf("Fresh inserts: %s\n", ryw ? "entry points" : "not used");
+   printf("Size queries : %s, every %d ms\n", exact ? "exact" : "approximate", poll);
+   if(inline_ops > 0)     printf("Maintenance  : inline, every %d operations\n", inline_ops);
+   else if(pool_size > 0) printf("Maintenance  : helper pool, %d per socket\n", pool_size);
+   else                   printf("Maintenance  : helper threads%s%s\n", idling ? ", idling" : "", sched_idle ? ", SCHED_IDLE" : "");
+   if(lend_depth > 0)     printf("Lending      : helpers read until %d operations are pending\n", lend_depth);
 
    timeout.tv_sec = duration / 1000;
    timeout.tv_nsec = (duration % 1000) * 1000000;
@@ -290,43 +700,89 @@ int main(int argc, char **argv) {
 
    if (seed == 0) { srand((int)time(0)); }
    else           { srand(seed); }
-   levelmax = floor_log_2((unsigned int) initial / nb_threads);
+   levelmax = floor_log_2((unsigned long) initial / nb_threads);
 
    // create sentinel node on NUMA zone 0
+   np_set_policy(placement, range, num_numa_zones);
+   cm_set_policy(backoff, rewalk, eliminate);
+   sz_set_exact(exact);
+   np_cache* main_cache = np_cache_new(0);
+   np_thread_init(main_cache);
    node_t* sentinel_node = node_new(0, NULL, NULL, NULL);
    // HOSK setup
    enclaves = (enclave**)malloc(nb_threads*sizeof(enclave*));
    pthread_t* thds = (pthread_t*)malloc(nb_threads*sizeof(pthread_t));
    allocators = (numa_allocator**)malloc(nb_threads*sizeof(numa_allocator*));
-   unsigned num_expected_nodes = (unsigned)((2 * initial * (1.0 + (update/100.0))) / nb_threads);
-   unsigned buffer_size = CACHE_LINE_SIZE * num_expected_nodes;
+   chunk_dirs = (mchunk_dir**)malloc(nb_threads*sizeof(mchunk_dir*));
+   node_pools = (np_cache**)malloc(nb_threads*sizeof(np_cache*));
+   helper_pools = (np_cache**)malloc(nb_threads*sizeof(np_cache*));
+   mig_init(nb_threads);
+   unsigned long num_expected_nodes = (unsigned long)((2 * initial * (1.0 + (update/100.0))) / nb_threads);
+   unsigned long buffer_size = CACHE_LINE_SIZE * num_expected_nodes;
 
    tinit_args** zargs = (tinit_args**)malloc(nb_threads*sizeof(tinit_args*));
-   int sock_id = 0;
-   int core_id = 0;
+   barrier_t ready;
+   barrier_init(&ready, nb_threads + 1);
+   hl_slot* placed = hl_place(cur_hw, enclave_policy, enclave_cpus, nb_threads);
    int opbuffer_sz = 2000000;   // TODO: fix the opbuffer size
+   // With the helper pool, each socket's hardware threads (the SMT siblings last) go to its
+   // application threads first and its last pool_size ones to its pool helpers
+   core_t* app_cores = NULL;
+   int* helper_cpus  = NULL;
+   int* helper_socks = NULL;
+   if(pool_size > 0) {
+      int slots = cur_hw->cores_per_socket * cur_hw->threads_per_core;
+      assert(pool_size < slots);
+      app_cores    = (core_t*)malloc(nb_threads * sizeof(core_t));
+      helper_cpus  = (int*)malloc(pool_threads * sizeof(int));
+      helper_socks = (int*)malloc(pool_threads * sizeof(int));
+      for(int s = 0; s < cur_hw->num_sockets; ++s) {
+         for(int h = 0; h < pool_size; ++h) {
+            int slot = slots - pool_size + h;
+            helper_cpus[s * pool_size + h]  = cur_hw->sockets[s].cores[slot % cur_hw->cores_per_socket]
+                                                 .hwthread_id[slot / cur_hw->cores_per_socket];
+            helper_socks[s * pool_size + h] = cur_hw->sockets[s].node;
+         }
+      }
+      for(int i = 0; i < nb_threads; ++i) {
+         // enclaves go round-robin across the sockets, as below
+         int s = i % cur_hw->num_sockets;
+         int slot = (i / cur_hw->num_sockets) % (slots - pool_size);
+         int cpu = cur_hw->sockets[s].cores[slot % cur_hw->cores_per_socket].hwthread_id[slot / cur_hw->cores_per_socket];
+         app_cores[i].hwthread_id[APP_IDX] = app_cores[i].hwthread_id[HLP_IDX] = cpu;
+      }
+   }
    for(int i = 0; i < nb_threads; ++i) {
       tinit_args* zia      = (tinit_args*)malloc(sizeof(tinit_args));
-      socket_t cur_sock    = cur_hw->sockets[sock_id];
       zia->node_sentinel   = sentinel_node;
       zia->allocator_size  = buffer_size;
       zia->buffer_size     = opbuffer_sz;
-      zia->core            = &cur_sock.cores[core_id];
-      zia->sock_num        = sock_id;
+      zia->learned         = learned;
+      zia->chunked         = chunked;
+      zia->relocate        = migrate || compact > 0 || cold > 0 || deferred;
+      zia->alloc_flags     = alloc_flags;
+      zia->freq            = update_frequency;
+      zia->ready           = &ready;
+      zia->core            = (pool_size > 0) ? &app_cores[i] : &placed[i].core;
+      zia->sock_num        = placed[i].node;
       zia->enclave_num     = i;
       zargs[i] = zia;
       pthread_create(&thds[i], NULL, thread_init, (void*)zia);
-      sock_id++;
-      if(sock_id == cur_hw->num_sockets) {
-         sock_id = 0;
-         core_id++;
-      }
    }
+   // the enclave threads persist: wait until all of them are ready
+   barrier_cross(&ready);
    for(int i = 0; i < nb_threads; ++i) {
-      pthread_join(thds[i], NULL);
       free(zargs[i]);
    }
    free(thds);
+   if(compact > 0 || cold > 0) {
+      // each enclave compacts and compresses its own slice of the key range
+      cold_init(range, cold);
+      for(int i = 0; i < nb_threads; ++i) {
+         mig_set_slice(enclaves[i]->mig, range_slice(range, nb_threads, i),
+                       range_slice(range, nb_threads, i + 1), compact);
+      }
+   }
 
    stop = 0;
    global_seed = rand();
@@ -336,52 +792,87 @@ int main(int argc, char **argv) {
    }
    pthread_setspecific(rng_seed_key, &global_seed);
 
-   // Initial skip list population
-   printf("Adding %d entries to set\n", initial);
    for(int i = 0; i < nb_threads; ++i) {
-      enclaves[i]->start_helper(true);
+      enclaves[i]->inline_ops = inline_ops;
+      enclaves[i]->pooled     = (pool_size > 0);
+      enclaves[i]->idling     = idling && 0 == inline_ops && 0 == pool_size;
+      enclaves[i]->sched_idle = sched_idle;
+      enclaves[i]->lend_depth = lend_depth;
+      if(lend_depth > 0) enclaves[i]->lent = new app_res();
    }
+
+   // Initial skip list population
+   printf("Adding %ld entries to set\n", initial);
    int add_nodes, successfully_added = 0;
-   uint last = 0;
-   int d = initial / nb_threads;
-   int m = initial % nb_threads;
-   init_param* pop_params = (init_param*)malloc(sizeof(init_param));
-   pop_params->range = range;
-   pop_params->seed = seed;
-   pop_params->last = &last;
-   int num_to_pop = 0;
-   for(int j = 0; j < nb_threads; ++j) {
-      // if size !divide across threads -> first m threads get + 1
-      // NOTE: no need to check m==0 due to if statement construction
-      if(j < m) num_to_pop = d + 1;
-      else      num_to_pop = d;
-      //successfully_added +=
-      enclaves[j]->populate_begin(pop_params, num_to_pop);
-   }
-   for(int k = 0; k < nb_threads; ++k) {
-      last = enclaves[k]->populate_end();
-      enclaves[k]->stop_helper();
-      enclaves[k]->reset_index_layer();
-   }
-   base_malloc = false;
-   for(int k = 0; k < nb_threads; ++k) {
-      enclaves[k]->start_helper(true);
-   }
-   free(pop_params);
-
-   size = data_layer_size(sentinel_node, 1);
-   printf("Set size     : %d\n", size);
+   sl_key_t last = 0;
+   long d = initial / nb_threads;
+   long m = initial % nb_threads;
+   if(bulk >= 0) {
+      // the index layers are built in place: no population index nodes to throw away
+      base_malloc = false;
+      gettimeofday(&start, NULL);
+      bl_pair* keys = bl_random(enclaves, nb_threads, initial, range, seed, bulk > 0);
+      long loaded = bl_load(enclaves, nb_threads, sentinel_node, keys, initial, bulk > 0);
+      gettimeofday(&end, NULL);
+      free(keys);
+      printf("Bulk load    : %ld us (%ld keys, %s)\n",
+             (end.tv_sec - start.tv_sec) * 1000000L + (end.tv_usec - start.tv_usec), loaded,
+             bulk ? "sorted" : "unsorted");
+      if(NULL != sentinel_node->next) last = sentinel_node->next->key;
+      if(large) validate(enclaves, nb_threads, range, num_numa_zones, loaded, NULL);
+   }
+   for(int i = 0; i < nb_threads; ++i) {
+      enclaves[i]->start_helper(bulk < 0);
+   }
+   hp_pool* helper_pool = NULL;
+   if(pool_size > 0) {
+      helper_pool = hp_start(enclaves, nb_threads, helper_cpus, helper_socks, pool_threads);
+   }
+   if(bulk < 0) {
+      init_param* pop_params = (init_param*)malloc(sizeof(init_param));
+      pop_params->range = range;
+      pop_params->seed = seed;
+      pop_params->last = &last;
+      long num_to_pop = 0;
+      for(int j = 0; j < nb_threads; ++j) {
+         // if size !divide across threads -> first m threads get + 1
+         // NOTE: no need to check m==0 due to if statement construction
+         if(j < m) num_to_pop = d + 1;
+         else      num_to_pop = d;
+         //successfully_added +=
+         enclaves[j]->populate_begin(pop_params, num_to_pop);
+      }
+      for(int k = 0; k < nb_threads; ++k) {
+         last = enclaves[k]->populate_end();
+      }
+      base_malloc = false;
+      AO_nop_full();
+      for(int k = 0; k < nb_threads; ++k) {
+         enclaves[k]->reset_index_layer();
+      }
+      free(pop_params);
+   }
+
+   size = sz_size(enclaves, nb_threads, exact);
+   printf("Set size     : %ld\n", size);
    printf("Level max    : %d\n", levelmax);
 
    // nullify index nodes to rebalance sl (deprecated)
 
-   // Reset helper thread with appropriate sleep time
-   for(int i = 0; i < nb_threads; ++i) {
-      while(enclaves[i]->get_sentinel()->intermed->level < (floor_log_2(d) - 1)){}
-      enclaves[i]->stop_helper();
-      enclaves[i]->start_helper(false);
+   // Wait for the helpers to rebuild the index layers, which then update at their usual frequency
+   // (a bulk load built them already)
+   for(int i = 0; bulk < 0 && i < nb_threads; ++i) {
+      enclaves[i]->wait_index(floor_log_2(d) - 1);
       //printf("  Level of enclave %2d: %d\n", i, enclaves[i]->get_sentinel()->intermed->level);
    }
+   if(freeze) {
+      int zones = (vn_num_nodes() < num_numa_zones) ? vn_num_nodes() : num_numa_zones;
+      gettimeofday(&start, NULL);
+      fz_freeze(enclaves, nb_threads, sentinel_node, zones, large ? size : -1);
+      gettimeofday(&end, NULL);
+      printf("Freeze time  : %ld us (%d replicas)\n",
+             (end.tv_sec - start.tv_sec) * 1000000L + (end.tv_usec - start.tv_usec), zones);
+   }
 
    barrier_init(&barrier, nb_threads + 1);
    pthread_attr_init(&attr);
@@ -392,9 +883,16 @@ int main(int argc, char **argv) {
       data[i].update = update;
       data[i].alternate = alternate;
       data[i].effective = effective;
+      data[i].hotspot = hotspot;
+      data[i].scan = scan;
       data[i].seed = rand();
       data[i].stop = &stop;
       data[i].barrier = &barrier;
+      enclaves[i]->migrate = migrate;
+      enclaves[i]->deferred = deferred;
+      if(ryw && NULL == enclaves[i]->pending) {
+         enclaves[i]->pending = (pt_table*)calloc(1, sizeof(pt_table));
+      }
       enclaves[i]->start_application(&data[i]);
    }
    pthread_attr_destroy(&attr);
@@ -412,7 +910,25 @@ int main(int argc, char **argv) {
 
    printf("STARTING...\n");
    gettimeofday(&start, NULL);
-   if (duration > 0) {
+   unsigned long polls = 0, poll_ns = 0;
+   long polled = 0;
+   if (duration > 0 && poll > 0) {
+      // sleep in poll periods, querying the set size after each
+      struct timespec period = {poll / 1000, (poll % 1000) * 1000000L};
+      for(int slept = 0; slept < duration; slept += poll) {
+         if(duration - slept < poll) {
+            period.tv_sec  = (duration - slept) / 1000;
+            period.tv_nsec = ((duration - slept) % 1000) * 1000000L;
+         }
+         nanosleep(&period, NULL);
+         struct timespec t0, t1;
+         clock_gettime(CLOCK_MONOTONIC, &t0);
+         polled = sz_size(enclaves, nb_threads, exact);
+         clock_gettime(CLOCK_MONOTONIC, &t1);
+         poll_ns += (t1.tv_sec - t0.tv_sec) * 1000000000L + (t1.tv_nsec - t0.tv_nsec);
+         polls++;
+      }
+   } else if (duration > 0) {
       nanosleep(&timeout, NULL);
    } else {
       sigemptyset(&block_set);
@@ -425,8 +941,29 @@ int main(int argc, char **argv) {
    printf("STOPPING...\n");
 
    // Wait for thread completion
+   unsigned long scans = 0, scanned = 0, scan_hops = 0;
+   unsigned long lent = 0, lends = 0;
+   unsigned long* lat  = (unsigned long*)calloc(LAT_BUCKETS, sizeof(unsigned long));
+   unsigned long* ulat = (unsigned long*)calloc(LAT_BUCKETS, sizeof(unsigned long));
+   cm_stats cm;
+   memset(&cm, 0, sizeof(cm_stats));
    for (i = 0; i < nb_threads; i++) {
       app_res* results = enclaves[i]->stop_application();
+      for(int b = 0; b < LAT_BUCKETS; ++b) {
+         lat[b]  += results->lat[b];
+         ulat[b] += results->ulat[b];
+      }
+      cm_stats* ecm = &enclaves[i]->cm;
+      cm.retries   += ecm->retries;
+      cm.contended += ecm->contended;
+      cm.spins     += ecm->spins;
+      if(ecm->max_retries > cm.max_retries) cm.max_retries = ecm->max_retries;
+      for(int b = 0; b < CM_RETRY_HIST; ++b) cm.hist[b] += ecm->hist[b];
+      cm.offers     += ecm->offers;
+      cm.eliminated += ecm->eliminated;
+      scans += results->scans;
+      scanned += results->scanned;
+      scan_hops += results->scan_hops;
       reads += results->contains;
       effreads += results->contains +
                  (results->add - results->added) +
@@ -436,6 +973,14 @@ int main(int argc, char **argv) {
       removes += results->removed;
       effupds += results->removed + results->added;
       size += results->added - results->removed;
+      if(NULL != enclaves[i]->lent) {
+         // the helper thread notices the stop after its current read
+         while(enclaves[i]->lending) sched_yield();
+         reads    += enclaves[i]->lent->contains;
+         effreads += enclaves[i]->lent->contains;
+         lent     += enclaves[i]->lent->contains;
+         lends    += enclaves[i]->lends;
+      }
       /*
       printf("Thread %d\n", i);
       printf("  #add        : %lu\n", results->add);
@@ -446,9 +991,24 @@ int main(int argc, char **argv) {
       printf("  #found      : %lu\n", results->found);
       */
    }
+   fz_thaw(enclaves, nb_threads);
+
+   // Stop background threads before walking the data layer: helpers retire data layer nodes,
+   // and the main thread holds no reclamation record (all of them first: helpers read each
+   // other's migration state)
+   for(int i = 0; i < nb_threads; ++i) {
+      enclaves[i]->stop_helper();
+   }
+   if(NULL != helper_pool) hp_stop(helper_pool);
    duration = (end.tv_sec * 1000 + end.tv_usec / 1000) - (start.tv_sec * 1000 + start.tv_usec / 1000);
 
-   printf("Set size      : %d (expected: %d)\n", data_layer_size(sentinel_node,1), size);
+   // (large scale: the layers are validated once the helpers stopped)
+   if(!large) printf("Set size      : %ld (expected: %ld)\n", data_layer_size(sentinel_node,1), size);
+   printf("Size counters : %ld (%ld keys indexed)\n", sz_size(enclaves, nb_threads, exact),
+          sz_indexed(enclaves, nb_threads));
+   if(polls > 0) {
+      printf("#size polls   : %lu (%f us each, last: %ld)\n", polls, poll_ns / 1000.0 / polls, polled);
+   }
    printf("Duration      : %d (ms)\n", duration);
    printf("#txs          : %lu (%f / s)\n", reads + updates, (reads + updates) * 1000.0 / duration);
    printf("#read txs     : ");
@@ -465,6 +1025,46 @@ int main(int argc, char **argv) {
       printf("  #rmvs: %lu(%f /s)\n", removes, removes * 1000.0 / duration);
       printf("  #upd trials : %lu (%f / s)\n", updates, updates * 1000.0 / duration);
    } else { printf("%lu (%f / s)\n", updates, updates * 1000.0 / duration); }
+   if (scans > 0) {
+      printf("#scans        : %lu (%f / s)\n", scans, scans * 1000.0 / duration);
+      printf("  keys/scan   : %f\n", (double)scanned / scans);
+      printf("  hops/scan   : %f\n", (double)scan_hops / scans);
+      printf("  ns/hop      : %f (upper bound: all thread time / hops)\n", duration * 1000000.0 * nb_threads / scan_hops);
+   }
+   print_latency("#contains lat ", lat);
+   print_latency("#update lat   ", ulat);
+   if(cm.retries > 0) {
+      printf("#retries      : %lu (%lu updates retried, at most %lu times, %lu backoff spins)\n",
+             cm.retries, cm.contended, cm.max_retries, cm.spins);
+      printf("  by retries  :");
+      for(int b = 0; b < CM_RETRY_HIST - 1; ++b) printf(" <%d: %lu", 2 << b, cm.hist[b]);
+      printf(" more: %lu", cm.hist[CM_RETRY_HIST - 1]);
+      printf("\n");
+   }
+   if(ryw) {
+      unsigned long hits = 0;
+      for(int i = 0; i < nb_threads; ++i) {
+         hits += enclaves[i]->pending->hits;
+      }
+      printf("#fresh entries: %lu operations\n", hits);
+   }
+   if(lend_depth > 0) {
+      printf("#lent reads   : %lu (%f / s, %lu lends)\n", lent, lent * 1000.0 / duration, lends);
+   }
+   if(vn_charging) {
+      unsigned long local = 0, remote = 0;
+      for(int i = 0; i < nb_threads; ++i) {
+         local  += enclaves[i]->vn.local;
+         remote += enclaves[i]->vn.remote;
+      }
+      printf("#remote nodes : %lu of %lu data node accesses (%f%%)\n", remote, local + remote,
+             (local + remote) ? 100.0 * remote / (local + remote) : 0.0);
+   }
+   if(eliminate) {
+      printf("#eliminated   : %lu updates (%lu offers)\n", cm.eliminated, cm.offers);
+   }
+   free(lat);
+   free(ulat);
 #ifdef COUNT_TRAVERSAL
    uint total_idx_travs = 0, total_dat_travs = 0, total_ops = 0;
    uint avg_idx_trav = 0, avg_dat_trav = 0;
@@ -503,17 +1103,107 @@ int main(int argc, char **argv) {
    printf(" #foreign accesses: %d\n", bkg_foreign);
 #endif
 
+   // NUMA zones of the live data layer nodes
+   if(!large) {
+      long* zone_nodes = (long*)calloc(NP_MAX_ZONES, sizeof(long));
+      for(temp = sentinel_node->next; temp != NULL; temp = temp->next) {
+         if(temp->val != NULL && temp->val != temp) zone_nodes[np_node_zone(temp)]++;
+      }
+      printf("Data zones    :");
+      for(int z = 0; z < num_numa_zones && z < NP_MAX_ZONES; ++z) {
+         printf(" %d: %ld", z, zone_nodes[z]);
+      }
+      printf("\n");
+      free(zone_nodes);
+   }
+
+   if(alloc_flags & NA_HUGEPAGES) {
+      unsigned hugetlb = 0;
+      for(int i = 0; i < nb_threads; ++i) {
+         hugetlb += allocators[i]->hugetlb_buffers();
+      }
+      printf("MAP_HUGETLB buffers: %u (others use transparent huge pages)\n", hugetlb);
+   }
+
+   if(idling && 0 == inline_ops && 0 == pool_size) {
+      unsigned long sleeps = 0, wakeups = 0;
+      for(int i = 0; i < nb_threads; ++i) {
+         sleeps  += enclaves[i]->sleeps;
+         wakeups += enclaves[i]->wakeups;
+      }
+      printf("Helper sleeps : %lu, %lu cut short\n", sleeps, wakeups);
+   }
+   if(NULL != helper_pool) {
+      unsigned long passes = 0, stolen = 0;
+      for(int h = 0; h < helper_pool->num_helpers; ++h) {
+         passes += helper_pool->helpers[h].passes;
+         stolen += helper_pool->helpers[h].stolen;
+      }
+      printf("Helper pool   : %d threads, %lu passes, %lu stolen\n", helper_pool->num_helpers, passes, stolen);
+      hp_free(helper_pool);
+   }
+   // Counters of the helpers (stable now that they stopped: cold segments keep forming
+   // once the updates stop)
+   if(compact > 0) {
+      unsigned long compacted = 0;
+      for(int i = 0; i < nb_threads; ++i) {
+         compacted += enclaves[i]->mig->compacted;
+      }
+      printf("Compacted     : %lu nodes\n", compacted);
+   }
+   if(cold > 0) {
+      cold_stats total = {0, 0, 0, 0};
+      for(int i = 0; i < nb_threads; ++i) {
+         total.segments += enclaves[i]->mig->cold.segments;
+         total.keys     += enclaves[i]->mig->cold.keys;
+         total.bytes    += enclaves[i]->mig->cold.bytes;
+         total.splits   += enclaves[i]->mig->cold.splits;
+      }
+      printf("Cold segments : %ld (%ld keys, %lu split)\n", total.segments, total.keys, total.splits);
+      if(total.keys > 0) {
+         printf("  bytes/key   : %f (data layer node: %lu)\n", (double)total.bytes / total.keys, sizeof(sl_node));
+      }
+   }
+   if(deferred) {
+      unsigned long swept = 0;
+      for(int i = 0; i < nb_threads; ++i) {
+         swept += enclaves[i]->mig->swept;
+      }
+      printf("Unlinked      : %lu nodes (by helper threads)\n", swept);
+   }
+   if(migrate) {
+      unsigned long moved = 0, sampled = 0, remote = 0;
+      for(int i = 0; i < nb_threads; ++i) {
+         moved   += enclaves[i]->mig->migrations;
+         sampled += enclaves[i]->mig->sampled;
+         remote  += enclaves[i]->mig->remote;
+      }
+      printf("Migrations    : %lu\n", moved);
+      printf("Local samples : %f%% (%lu sampled)\n", sampled ? 100.0 * (sampled - remote) / sampled : 100.0, sampled);
+   }
+   // (large scale: the validation counts the data layer nodes in parallel)
+   ma_report* mem = ma_collect(enclaves, nb_threads, large ? NULL : sentinel_node, main_cache);
+   if(large) validate(enclaves, nb_threads, range, num_numa_zones, size, mem);
+   print_memory(mem, num_numa_zones);
+   ma_free(mem);
+
    printf("Cleaning up...\n");
-   // Stop background threads
    for(int i = 0; i < nb_threads; ++i) {
-      enclaves[i]->stop_helper();
       delete enclaves[i];
       delete allocators[i];
    }
    free_hardware_layout(cur_hw);
+   free(placed);
+   free(app_cores);
+   free(helper_cpus);
+   free(helper_socks);
    free(threads);
    free(data);
    free(allocators);
+   free(chunk_dirs);
+   free(node_pools);
+   free(helper_pools);
+   mig_fini();
    free(enclaves);
    return 0;
 }
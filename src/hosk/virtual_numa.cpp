@@ -0,0 +1,89 @@
+/*
+ * virtual_numa.cpp: simulated multi-socket topology on a machine with fewer NUMA nodes
+ *
+ * Author: Henry Daly, 2018
+ */
+
+/**
+ * Module Overview:
+ *
+ * A single-node machine cannot exercise the NUMA placement of the skip list. In virtual
+ * mode, the enclaves run on vn_sockets virtual sockets of a given number of cores, mapped
+ * round-robin onto the real cores, and every virtual socket is a NUMA zone of its own.
+ * The data node caches tag their slabs with these virtual zones, so each data layer node
+ * still belongs to a zone, but the memory itself is bound to the real node backing the
+ * zone (vn_node()).
+ *
+ * The application threads then count their data layer node accesses as local or remote
+ * by the zone tag of the node's slab. Optionally, each remote access is charged a delay
+ * (a number of pause instructions, calibrated against the clock at startup), which
+ * approximates the latency of the remote node on a real multi-socket machine. The index
+ * and intermediate layers are always allocated on the enclave's own zone, so they are
+ * neither counted nor charged.
+ */
+
+#include <numa.h>
+#include <stdlib.h>
+#include <time.h>
+#include "virtual_numa.h"
+
+int  vn_sockets  = 0;
+bool vn_charging = false;
+int  vn_pauses   = 0;
+
+/**
+ * vn_layout() - a virtual layout of @sockets sockets of @cores cores each
+ * @real    - the real hardware layout (its cores back the virtual ones, round-robin)
+ * @sockets - the number of virtual sockets (each one is a NUMA zone)
+ * @cores   - the number of cores of each virtual socket
+ */
+hl_t* vn_layout(hl_t* real, int sockets, int cores) {
+   hl_t* machine = (hl_t*)malloc(sizeof(hl_t));
+   machine->num_sockets      = sockets;
+   machine->cores_per_socket = cores;
+   machine->threads_per_core = real->threads_per_core;
+   machine->max_cpu_num      = sockets * cores * real->threads_per_core;
+   machine->sockets = (socket_t*)malloc(sockets * sizeof(socket_t));
+   int rs = 0, rc = 0;
+   for(int s = 0; s < sockets; ++s) {
+      socket_t* vsocket  = &machine->sockets[s];
+      vsocket->cores     = (core_t*)malloc(cores * sizeof(core_t));
+      vsocket->num_cores = cores;
+      vsocket->package   = s;
+      vsocket->node      = s;
+      for(int c = 0; c < cores; ++c) {
+         vsocket->cores[c] = real->sockets[rs].cores[rc];
+         if(++rc == real->sockets[rs].num_cores) {
+            rc = 0;
+            rs = (rs + 1) % real->num_sockets;
+         }
+      }
+   }
+   vn_sockets = sockets;
+   return machine;
+}
+
+/**
+ * vn_set_cost() - count the data node accesses, charging @ns nanoseconds per remote one
+ *  (calibrates the number of pause instructions it takes)
+ */
+void vn_set_cost(int ns) {
+   struct timespec t0, t1;
+   clock_gettime(CLOCK_MONOTONIC, &t0);
+   for(int i = 0; i < VN_CALIBRATE_PAUSES; ++i) PAUSE();
+   clock_gettime(CLOCK_MONOTONIC, &t1);
+   double elapsed = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+   vn_pauses   = (ns > 0) ? (int)(ns * VN_CALIBRATE_PAUSES / elapsed + 0.5) : 0;
+   if(ns > 0 && vn_pauses < 1) vn_pauses = 1;
+   vn_charging = true;
+}
+
+/* vn_node() - the real NUMA node backing @zone */
+int vn_node(int zone) {
+   return (vn_sockets > 0) ? zone % (numa_max_node() + 1) : zone;
+}
+
+/* vn_num_nodes() - the number of NUMA zones (virtual sockets in virtual mode) */
+int vn_num_nodes(void) {
+   return (vn_sockets > 0) ? vn_sockets : numa_num_configured_nodes();
+}
@@ -0,0 +1,47 @@
+/*
+ * Interface for the virtual NUMA topology
+ *
+ * Author: Henry Daly, 2018
+ */
+#ifndef VIRTUAL_NUMA_H_
+#define VIRTUAL_NUMA_H_
+
+#include "common.h"
+#include "hardware_layout.h"
+#include "node_pool.h"
+
+#define VN_CALIBRATE_PAUSES  (1 << 20)   // pause instructions timed to calibrate the remote access cost
+
+/* vn_stats counts the data layer node accesses of an enclave's application thread (virtual mode) */
+struct vn_stats {
+   unsigned long  local;      // nodes on the enclave's own virtual zone
+   unsigned long  remote;     // nodes on another virtual zone
+};
+
+extern int  vn_sockets;    // virtual sockets (0 = real topology)
+extern bool vn_charging;   // data node accesses are counted (and charged if vn_pauses > 0)
+extern int  vn_pauses;     // pause instructions charged per remote access
+
+hl_t*  vn_layout(hl_t* real, int sockets, int cores);
+void   vn_set_cost(int ns);
+int    vn_node(int zone);
+int    vn_num_nodes(void);
+
+/**
+ * vn_access() - count an access to the data node @node from virtual zone @zone, and
+ *  charge the remote access cost if the node's slab belongs to another virtual zone
+ * @zone  - the virtual zone of the accessing enclave
+ * @node  - the data layer node (NULL is not an access)
+ * @stats - the enclave's counters
+ */
+static inline void vn_access(int zone, void* node, vn_stats* stats) {
+   if(NULL == node) return;
+   if(np_node_zone(node) == zone) {
+      stats->local++;
+      return;
+   }
+   stats->remote++;
+   for(int i = 0; i < vn_pauses; ++i) PAUSE();
+}
+
+#endif /* VIRTUAL_NUMA_H_ */